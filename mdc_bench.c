@@ -0,0 +1,1030 @@
+/*-
+ * mdc_bench.c
+ *   Micro-benchmarks for mdc_decode and mdc_encode
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+/*
+ * usage: mdc_bench [name ...]
+ *  runs the named benchmarks, or all of them if none are named
+ */
+
+#if defined(__linux__)
+#define _GNU_SOURCE	// for mdc_engine.c, included below
+#endif
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mdc_encode.h"
+#include "mdc_decode.h"
+
+/* pull in the decoder (and mdc_common.c) directly, to reach its internals */
+#include "mdc_decode.c"
+#include "mdc_pool.c"
+#include "mdc_engine.c"
+#include "mdc_bus.c"
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static mdc_u32_t rseed = 1;
+
+static mdc_u32_t rnd(void)
+{
+	rseed = rseed * 1103515245 + 12345;
+	return rseed >> 8;
+}
+
+/* keep the optimizer from discarding benchmarked work */
+static volatile mdc_u32_t sink;
+
+
+/* CRC: table-driven _docrc against the original bit-serial version */
+
+static mdc_u16_t _flip(mdc_u16_t crc, mdc_int_t bitnum)
+{
+	mdc_u16_t crcout, i, j;
+
+	j = 1;
+	crcout = 0;
+
+	for (i=1<<(bitnum-1); i; i>>=1)
+	{
+		if (crc & i)
+			 crcout |= j;
+		j<<= 1;
+	}
+	return (crcout);
+}
+
+static mdc_u16_t _docrc_bitwise(mdc_u8_t *p, int len)
+{
+	mdc_int_t i, j;
+	mdc_u16_t c;
+	mdc_int_t bit;
+	mdc_u16_t crc = 0x0000;
+
+	for (i=0; i<len; i++)
+	{
+		c = (mdc_u16_t)*p++;
+
+		c = _flip(c, 8);
+
+		for (j=0x80; j; j>>=1)
+		{
+			bit = crc & 0x8000;
+			crc<<= 1;
+			if (c & j)
+				bit^= 0x8000;
+			if (bit)
+				crc^= 0x1021;
+		}
+	}
+
+	crc = _flip(crc, 16);
+	crc ^= 0xffff;
+	crc &= 0xFFFF;
+
+	return(crc);
+}
+
+#define CRC_BULK 4096
+
+static void bench_crc(void)
+{
+	static mdc_u8_t buf[CRC_BULK];
+	mdc_int_t i, len, n;
+	mdc_u32_t acc;
+	double t, tbit, ttab;
+
+	for(i=0; i<CRC_BULK; i++)
+		buf[i] = rnd();
+
+	for(n=0; n<100000; n++)
+	{
+		len = rnd() % 64;
+		i = rnd() % (CRC_BULK - 64);
+		if(_docrc(buf + i, len) != _docrc_bitwise(buf + i, len))
+		{
+			fprintf(stderr,"crc: mismatch at offset %d length %d\n", i, len);
+			exit(-1);
+		}
+	}
+
+	n = 4000000;
+	acc = 0;
+	t = now();
+	for(i=0; i<n; i++)
+		acc += _docrc_bitwise(buf + (i & 1023), 4);
+	tbit = now() - t;
+	t = now();
+	for(i=0; i<n; i++)
+		acc += _docrc(buf + (i & 1023), 4);
+	ttab = now() - t;
+	sink = acc;
+	printf("crc 4-byte:  bitwise %6.1f ns  table %6.1f ns  speedup %.1fx\n",
+	       tbit * 1e9 / n, ttab * 1e9 / n, tbit / ttab);
+
+	n = 2000;
+	t = now();
+	for(i=0; i<n; i++)
+		acc += _docrc_bitwise(buf + (i & 7), CRC_BULK - 8);
+	tbit = now() - t;
+	t = now();
+	for(i=0; i<n; i++)
+		acc += _docrc(buf + (i & 7), CRC_BULK - 8);
+	ttab = now() - t;
+	sink = acc;
+	printf("crc bulk:    bitwise %6.1f MB/s  table %6.1f MB/s  speedup %.1fx\n",
+	       n * (double)(CRC_BULK - 8) / tbit / 1e6, n * (double)(CRC_BULK - 8) / ttab / 1e6, tbit / ttab);
+}
+
+
+
+/* packet layout: word-level _enc_str against the original shift-register version */
+
+static mdc_u8_t * _enc_str_bitwise(mdc_u8_t *data)
+{
+	mdc_u16_t ccrc;
+	mdc_int_t i, j;
+	mdc_int_t k;
+	mdc_int_t m;
+	mdc_int_t csr[7];
+	mdc_int_t b;
+	mdc_int_t lbits[112];
+
+	ccrc = _docrc(data, 4);
+
+	data[4] = ccrc & 0x00ff;
+	data[5] = (ccrc >> 8) & 0x00ff;
+
+	data[6] = 0;
+
+	for(i=0; i<7; i++)
+		csr[i] = 0;
+
+	for(i=0; i<7; i++)
+	{
+		data[i+7] = 0;
+		for(j=0; j<=7; j++)
+		{
+			for(k=6; k > 0; k--)
+				csr[k] = csr[k-1];
+			csr[0] = (data[i] >> j) & 0x01;
+			b = csr[0] + csr[2] + csr[5] + csr[6];
+			data[i+7] |= (b & 0x01) << j;
+		}
+	}
+
+	k=0;
+	m=0;
+	for(i=0; i<14; i++)
+	{
+		for(j=0; j<=7; j++)
+		{
+			b = 0x01 & (data[i] >> j);
+			lbits[k] = b;
+			k += 16;
+			if(k > 111)
+				k = ++m;
+		}
+	}
+
+	k = 0;
+	for(i=0; i<14; i++)
+	{
+		data[i] = 0;
+		for(j=7; j>=0; j--)
+		{
+			if(lbits[k])
+				data[i] |= 1<<j;
+			++k;
+		}
+	}
+
+	return &(data[14]);
+}
+
+// a double packet laid out the original way, after the 12-byte leader
+static void _packet_bitwise(mdc_u8_t *data, const mdc_u8_t *bytes)
+{
+	memcpy(data, bytes, 4);
+	memcpy(_enc_str_bitwise(data), bytes + 4, 4);
+	_enc_str_bitwise(data + 14);
+}
+
+#define PACKET_RUNS 1000000
+
+static void bench_packet(void)
+{
+	static mdc_u8_t bytes[1024 + 8];
+	mdc_u8_t ref[28];
+	mdc_encoder_t *encoder;
+	mdc_int_t i, n;
+	mdc_u32_t acc;
+	double t, tbit, tword;
+
+	encoder = mdc_encoder_new(8000);
+	if(!encoder)
+	{
+		fprintf(stderr,"packet: create failed\n");
+		exit(-1);
+	}
+
+	for(i=0; i<(mdc_int_t)sizeof(bytes); i++)
+		bytes[i] = rnd();
+
+	for(n=0; n<100000; n++)
+	{
+		for(i=0; i<8; i++)
+			bytes[i] = rnd();
+		_packet_bitwise(ref, bytes);
+		encoder->loaded = 0;
+		mdc_encoder_set_double_packet(encoder, bytes[0], bytes[1], (bytes[2] << 8) | bytes[3],
+		                              bytes[4], bytes[5], bytes[6], bytes[7]);
+		if(memcmp(encoder->data + 12, ref, 28))
+		{
+			fprintf(stderr,"packet: mismatch for %02x %02x %02x %02x %02x %02x %02x %02x\n",
+			        bytes[0], bytes[1], bytes[2], bytes[3], bytes[4], bytes[5], bytes[6], bytes[7]);
+			exit(-1);
+		}
+	}
+
+	acc = 0;
+	t = now();
+	for(n=0; n<PACKET_RUNS; n++)
+	{
+		_packet_bitwise(ref, bytes + (n & 1023));
+		acc += ref[n % 28];
+	}
+	tbit = now() - t;
+	t = now();
+	for(n=0; n<PACKET_RUNS; n++)
+	{
+		i = n & 1023;
+		encoder->loaded = 0;
+		mdc_encoder_set_double_packet(encoder, bytes[i], bytes[i+1], (bytes[i+2] << 8) | bytes[i+3],
+		                              bytes[i+4], bytes[i+5], bytes[i+6], bytes[i+7]);
+		acc += encoder->data[12 + n % 28];
+	}
+	tword = now() - t;
+	sink = acc;
+	printf("packet double:  bitwise %6.1f ns  word %6.1f ns  speedup %.1fx\n",
+	       tbit * 1e9 / PACKET_RUNS, tword * 1e9 / PACKET_RUNS, tbit / tword);
+
+	mdc_encoder_destroy(encoder);
+}
+
+
+
+/* ECC: word-level _gofix against the original shift-register version */
+
+static void _gofix_bitwise(unsigned char *data)
+{
+	int i, j, b, k;
+	int csr[7];
+	int syn;
+	int fixi,fixj;
+	int ec;
+
+	syn = 0;
+	for(i=0; i<7; i++)
+		csr[i] = 0;
+
+	for(i=0; i<7; i++)
+	{
+		for(j=0; j<=7; j++)
+		{
+			for(k=6; k > 0; k--)
+				csr[k] = csr[k-1];
+
+			csr[0] = (data[i] >> j) & 0x01;
+			b = csr[0] + csr[2] + csr[5] + csr[6];
+			syn <<= 1;
+			if( (b & 0x01) ^ ((data[i+7] >> j) & 0x01) )
+			{
+				syn |= 1;
+			}
+			ec = 0;
+			if(syn & 0x80) ++ec;
+			if(syn & 0x20) ++ec;
+			if(syn & 0x04) ++ec;
+			if(syn & 0x02) ++ec;
+			if(ec >= 3)
+			{
+				syn ^= 0xa6;
+				fixi = i;
+				fixj = j-7;
+				if(fixj < 0)
+				{
+					--fixi;
+					fixj += 8;
+				}
+				if(fixi >= 0)
+					data[fixi] ^= 1<<fixj; // flip
+			}
+		}
+	}
+}
+
+/* a valid 14-byte frame (data plus parity) with nerr random bits flipped */
+static void _ecc_frame(mdc_u8_t *data, int nerr)
+{
+	int i, j, k, b;
+	int csr[7];
+
+	for(i=0; i<7; i++)
+		data[i] = rnd();
+
+	for(i=0; i<7; i++)
+		csr[i] = 0;
+
+	for(i=0; i<7; i++)
+	{
+		data[i+7] = 0;
+		for(j=0; j<=7; j++)
+		{
+			for(k=6; k > 0; k--)
+				csr[k] = csr[k-1];
+			csr[0] = (data[i] >> j) & 0x01;
+			b = csr[0] + csr[2] + csr[5] + csr[6];
+			data[i+7] |= (b & 0x01) << j;
+		}
+	}
+
+	while(nerr--)
+	{
+		k = rnd() % 112;
+		data[k >> 3] ^= 1 << (k & 7);
+	}
+}
+
+#define ECC_FRAMES 1024
+
+static void bench_ecc(void)
+{
+	static mdc_u8_t frames[ECC_FRAMES][14];
+	mdc_u8_t a[14], b[14];
+	mdc_int_t i, n, nerr;
+	mdc_u32_t acc;
+	double t, tbit, tword;
+
+	for(n=0; n<1000000; n++)
+	{
+		nerr = n % 8;
+		_ecc_frame(a, nerr);
+		if(nerr == 7)
+			for(i=0; i<14; i++) // entirely random candidate
+				a[i] = rnd();
+		memcpy(b, a, 14);
+		_gofix_bitwise(a);
+		_gofix(b);
+		if(memcmp(a, b, 14))
+		{
+			fprintf(stderr,"ecc: correction mismatch (%d errors)\n", nerr);
+			exit(-1);
+		}
+	}
+
+	for(nerr=0; nerr<=4; nerr+=2)
+	{
+		for(i=0; i<ECC_FRAMES; i++)
+			_ecc_frame(frames[i], nerr);
+
+		n = 1000000;
+		acc = 0;
+		t = now();
+		for(i=0; i<n; i++)
+		{
+			memcpy(a, frames[i & (ECC_FRAMES-1)], 14);
+			_gofix_bitwise(a);
+			acc += a[i % 7];
+		}
+		tbit = now() - t;
+		t = now();
+		for(i=0; i<n; i++)
+		{
+			memcpy(a, frames[i & (ECC_FRAMES-1)], 14);
+			_gofix(a);
+			acc += a[i % 7];
+		}
+		tword = now() - t;
+		sink = acc;
+		printf("ecc %d errors: bitwise %6.1f ns  word %6.1f ns  speedup %.1fx\n", nerr,
+		       tbit * 1e9 / n, tword * 1e9 / n, tbit / tword);
+	}
+}
+
+
+/* pool: many channels from one arena against separately allocated decoders */
+
+#define POOL_CHANNELS 10000
+#define POOL_BLOCK 160	// 10 msec at 16 kHz
+#define POOL_ROUNDS 20
+
+// best of three passes over all channels, in seconds
+static double _pool_run(mdc_decoder_t **decoders, const mdc_sample_t *block)
+{
+	mdc_int_t i, k, r;
+	double t, best = 0;
+
+	for(k=0; k<3; k++)
+	{
+		t = now();
+		for(r=0; r<POOL_ROUNDS; r++)
+			for(i=0; i<POOL_CHANNELS; i++)
+				mdc_decoder_process_samples(decoders[i], (mdc_sample_t *)block, POOL_BLOCK);
+		t = now() - t;
+		if(!k || t < best)
+			best = t;
+	}
+	return best;
+}
+
+static void bench_pool(void)
+{
+	static mdc_decoder_t *heap[POOL_CHANNELS], *pooled[POOL_CHANNELS];
+	static void *junk[POOL_CHANNELS];
+	static mdc_sample_t block[POOL_BLOCK];
+	mdc_decoder_pool_t *pool;
+	mdc_decoder_t *d;
+	mdc_int_t i, j, flags;
+	double theap, tpool;
+
+	for(i=0; i<POOL_BLOCK; i++)
+		block[i] = (mdc_s16_t)(rnd() & 0xffff) >> 2;
+
+	// separately allocated, interleaved with other allocations as a long-running process would be
+	for(i=0; i<POOL_CHANNELS; i++)
+	{
+		heap[i] = mdc_decoder_new(16000);
+		junk[i] = malloc(64 + rnd() % 4096);
+	}
+	for(i=POOL_CHANNELS-1; i>0; i--)
+	{
+		j = rnd() % (i + 1);
+		d = heap[i];
+		heap[i] = heap[j];
+		heap[j] = d;
+	}
+
+	theap = _pool_run(heap, block);
+
+	for(flags=0; flags<=MDC_POOL_HUGEPAGES; flags++)
+	{
+		pool = mdc_decoder_pool_new(16000, POOL_CHANNELS, flags);
+		if(!pool)
+		{
+			fprintf(stderr,"pool: create failed\n");
+			exit(-1);
+		}
+		i = 0;
+		while((d = mdc_decoder_pool_acquire(pool)))
+			pooled[i++] = d;
+
+		tpool = _pool_run(pooled, block);
+
+		printf("pool %d channels%s: heap %6.1f ns/sample  pool %6.1f ns/sample  speedup %.2fx\n",
+		       POOL_CHANNELS, flags ? " (huge pages)" : "",
+		       theap * 1e9 / ((double)POOL_ROUNDS * POOL_CHANNELS * POOL_BLOCK),
+		       tpool * 1e9 / ((double)POOL_ROUNDS * POOL_CHANNELS * POOL_BLOCK), theap / tpool);
+
+		mdc_decoder_pool_destroy(pool);
+	}
+
+	for(i=0; i<POOL_CHANNELS; i++)
+	{
+		mdc_decoder_destroy(heap[i]);
+		free(junk[i]);
+	}
+}
+
+
+/* engine: a few thousand channels decoded on 1..N worker threads, unpinned and pinned */
+
+#define ENGINE_CHANNELS 2000
+#define ENGINE_STREAMS 16	// distinct synthetic streams, shared out among the channels
+#define ENGINE_STREAM 16000	// 1 second at 16 kHz
+#define ENGINE_BLOCK 160
+
+static void bench_engine(void)
+{
+	static mdc_sample_t streams[ENGINE_STREAMS][ENGINE_STREAM];
+	mdc_encoder_t *encoder;
+	mdc_engine_t *engine;
+	mdc_decoder_event_t events[256];
+	mdc_int_t i, k, n, w, maxWorkers, found, flags, nodes;
+	int node;
+	unsigned long jobs, steals, cross, totalSteals, totalCross;
+	double t, t1 = 0;
+
+	// two packets a second with silence between, each stream with its own unit IDs
+	encoder = mdc_encoder_new(16000);
+	for(k=0; k<ENGINE_STREAMS; k++)
+	{
+		memset(streams[k], 0, sizeof(streams[k]));
+		for(i=0; i<ENGINE_STREAM; i+=ENGINE_STREAM/2)
+		{
+			mdc_encoder_set_packet(encoder, 0x01, 0x80, 0x1000 + k);
+			for(n=i; n<i+ENGINE_STREAM/2; n+=found)
+				if((found = mdc_encoder_get_samples(encoder, streams[k] + n, i + ENGINE_STREAM/2 - n)) <= 0)
+					break;
+		}
+	}
+	mdc_encoder_destroy(encoder);
+
+	maxWorkers = sysconf(_SC_NPROCESSORS_ONLN);
+	if(maxWorkers < 4)
+		maxWorkers = 4;
+
+	for(flags=0; flags<=MDC_ENGINE_PIN; flags+=MDC_ENGINE_PIN)
+	{
+		for(w=1; w<=maxWorkers; w++)
+		{
+			engine = mdc_engine_new(16000, ENGINE_CHANNELS, w, flags);
+			if(!engine)
+			{
+				fprintf(stderr,"engine: create failed\n");
+				exit(-1);
+			}
+
+			found = 0;
+			t = now();
+			for(i=0; i<ENGINE_STREAM; i+=ENGINE_BLOCK)
+			{
+				for(k=0; k<ENGINE_CHANNELS; k++)
+					mdc_engine_submit(engine, k, streams[k % ENGINE_STREAMS] + i, ENGINE_BLOCK);
+				while((n = mdc_engine_get_events(engine, events, 256)) > 0)
+					found += n;
+			}
+			mdc_engine_flush(engine);
+			t = now() - t;
+			while((n = mdc_engine_get_events(engine, events, 256)) > 0)
+				found += n;
+
+			totalSteals = 0;
+			totalCross = 0;
+			nodes = 0;
+			for(k=0; k<w; k++)
+			{
+				steals = cross = 0;
+				node = -1;
+				mdc_engine_get_stats(engine, k, &jobs, &steals);
+				mdc_engine_get_placement(engine, k, 0L, &node, &cross);
+				totalSteals += steals;
+				totalCross += cross;
+				if(node >= 0 && node < 32)
+					nodes |= 1 << node;
+			}
+			if(w == 1)
+				t1 = t;
+
+			printf("engine %d channels %2d workers%s: %7.2f Msamples/s  scaling %.2fx  packets %d  steals %lu (cross-node %lu)  nodes %d\n",
+			       ENGINE_CHANNELS, w, flags ? " pinned" : "       ", (double)ENGINE_CHANNELS * ENGINE_STREAM / t / 1e6, t1 / t,
+			       found, totalSteals, totalCross, __builtin_popcount(nodes));
+
+			mdc_engine_destroy(engine);
+		}
+	}
+}
+
+/* bus: packets published from several threads, lock-free against a mutex-protected ring */
+
+#define BUS_EVENTS 50000	// per publisher
+#define BUS_CAPACITY (1 << 19)	// room for every packet from 8 publishers, so neither ring drops
+
+typedef struct {
+	pthread_mutex_t lock;
+	mdc_decoder_event_t ring[BUS_CAPACITY];
+	unsigned long head;
+	unsigned long tail;
+	unsigned long dropped;
+} mutex_ring_t;
+
+static mutex_ring_t mring;
+static mdc_event_bus_t *bbus;
+static int useBus;
+static int publishersDone;
+
+static void * _bus_publisher(void *arg)
+{
+	mdc_decoder_event_t event;
+	mdc_int_t i;
+
+	memset(&event, 0, sizeof(event));
+	event.channel = (int)(long)arg;
+	for(i=0; i<BUS_EVENTS; i++)
+	{
+		event.syncSample = i;
+		if(useBus)
+			mdc_event_bus_publish(bbus, &event);
+		else
+		{
+			pthread_mutex_lock(&mring.lock);
+			if(mring.head - mring.tail == BUS_CAPACITY)
+				mring.dropped++;
+			else
+				mring.ring[mring.head++ % BUS_CAPACITY] = event;
+			pthread_mutex_unlock(&mring.lock);
+		}
+	}
+	__atomic_add_fetch(&publishersDone, 1, __ATOMIC_SEQ_CST);
+	return (void *)0L;
+}
+
+static int _bus_drain(mdc_decoder_event_t *events, int max)
+{
+	int n;
+
+	if(useBus)
+		return mdc_event_bus_drain(bbus, events, max);
+
+	pthread_mutex_lock(&mring.lock);
+	for(n=0; n<max && mring.tail != mring.head; n++)
+		events[n] = mring.ring[mring.tail++ % BUS_CAPACITY];
+	pthread_mutex_unlock(&mring.lock);
+	return n;
+}
+
+static void bench_bus(void)
+{
+	mdc_decoder_event_t events[256];
+	pthread_t threads[8];
+	mdc_int_t i, p, done;
+	unsigned long received, dropped;
+	double t;
+
+	pthread_mutex_init(&mring.lock, 0L);
+
+	for(p=1; p<=8; p*=2)
+	{
+		for(useBus=0; useBus<=1; useBus++)
+		{
+			bbus = mdc_event_bus_new(BUS_CAPACITY);
+			mring.head = mring.tail = mring.dropped = 0;
+			publishersDone = 0;
+			received = 0;
+			dropped = 0;
+
+			t = now();
+			for(i=0; i<p; i++)
+				pthread_create(&threads[i], 0L, _bus_publisher, (void *)(long)i);
+			do
+			{
+				done = __atomic_load_n(&publishersDone, __ATOMIC_SEQ_CST) == p;
+				while((i = _bus_drain(events, 256)) > 0)
+					received += i;
+			} while(!done);
+			t = now() - t;
+			for(i=0; i<p; i++)
+				pthread_join(threads[i], 0L);
+
+			if(useBus)
+				mdc_event_bus_get_stats(bbus, 0L, &dropped);
+			else
+				dropped = mring.dropped;
+
+			// publish to drain, so the figure is for packets delivered
+			printf("bus %d publishers %-9s: %6.2f Mpackets/s delivered  received %lu  dropped %lu\n", p,
+			       useBus ? "lock-free" : "mutex", received / t / 1e6, received, dropped);
+			mdc_event_bus_destroy(bbus);
+		}
+	}
+}
+
+
+/* pll: the fixed-phase units against clock recovery, CPU per channel and packets decoded */
+
+#define PLL_PACKETS 200
+#define PLL_GAP 4096	// silence between packets, plus up to a bit's worth more
+#define PLL_BLOCK 160
+
+// one channel's worth of packets, with noise of about the given rms, sent at encoderRate
+static mdc_int_t _pll_stream(mdc_sample_t *stream, int encoderRate, int noise)
+{
+	mdc_encoder_t *encoder;
+	mdc_int_t p, i, n, len = 0;
+
+	encoder = mdc_encoder_new(encoderRate);
+	for(p=0; p<PLL_PACKETS; p++)
+	{
+		n = PLL_GAP + rnd() % (encoderRate / 1200);
+		for(i=0; i<n; i++)
+			stream[len++] = 0;
+		mdc_encoder_set_packet(encoder, 0x01, p & 0xff, 0x4000 + p);
+		while((n = mdc_encoder_get_samples(encoder, stream + len, 4096)) > 0)
+			len += n;
+	}
+	for(i=0; i<PLL_GAP; i++)
+		stream[len++] = 0;
+	mdc_encoder_destroy(encoder);
+
+	for(i=0; i<len; i++)
+	{
+		// sum of four uniform values, roughly gaussian
+		int v = 0;
+		for(n=0; n<4; n++)
+			v += (int)(rnd() & 0xffff) - 0x8000;
+		v = stream[i] + (int)((long long)v * noise / 0x10000);
+		stream[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+	}
+	return len;
+}
+
+static void bench_pll(void)
+{
+	static const struct {
+		const char *name;
+		int noise;
+		int offset;	// sender clock error, parts per 10000
+	} conds[] = {
+		{ "clean", 0, 0 },
+		{ "noisy", 20000, 0 },
+		{ "clock +0.2%", 0, 20 },
+	};
+	static char found[PLL_PACKETS];
+	mdc_sample_t *stream;
+	mdc_decoder_t *decoder;
+	mdc_decoder_event_t events[16];
+	mdc_int_t rate, c, units, i, n, k, len, count;
+	double t, tfixed = 0;
+
+	stream = (mdc_sample_t *)malloc((48000 / 5 + 2 * PLL_GAP) * PLL_PACKETS * sizeof(mdc_sample_t));
+	if(!stream)
+	{
+		fprintf(stderr,"pll: create failed\n");
+		exit(-1);
+	}
+
+	for(rate=16000; rate<=48000; rate+=32000)
+	{
+		for(c=0; c<(mdc_int_t)(sizeof(conds)/sizeof(conds[0])); c++)
+		{
+			len = _pll_stream(stream, rate + rate / 10000 * conds[c].offset, conds[c].noise);
+
+			for(units=0; units<=MDC_PLLUNITS; units++)
+			{
+				decoder = mdc_decoder_new(rate);
+				if(!decoder || mdc_decoder_set_pll(decoder, units))
+				{
+					fprintf(stderr,"pll: create failed\n");
+					exit(-1);
+				}
+
+				memset(found, 0, sizeof(found));
+				t = now();
+				for(i=0; i<len; i+=PLL_BLOCK)
+				{
+					mdc_decoder_process_samples(decoder, stream + i, len - i < PLL_BLOCK ? len - i : PLL_BLOCK);
+					while((n = mdc_decoder_get_events(decoder, events, 16)) > 0)
+						for(k=0; k<n; k++)
+							if(events[k].unitID >= 0x4000 && events[k].unitID < 0x4000 + PLL_PACKETS)
+								found[events[k].unitID - 0x4000] = 1;
+				}
+				t = now() - t;
+				mdc_decoder_destroy(decoder);
+
+				count = 0;
+				for(k=0; k<PLL_PACKETS; k++)
+					count += found[k];
+				if(!units)
+					tfixed = t;
+
+				printf("pll %d %-12s %-15s: %6.2f ns/sample  %.2fx  decoded %5.1f%%\n",
+				       rate, conds[c].name, units ? (units == 1 ? "pll 1 unit" : (units == 2 ? "pll 2 units" : "pll 3 units")) : "fixed 5 units",
+				       t * 1e9 / len, tfixed / t, 100.0 * count / PLL_PACKETS);
+			}
+		}
+	}
+
+	free(stream);
+}
+
+/* encode: samples synthesized per second, by rate and output format */
+
+#define ENCODE_PACKETS 2000
+#define ENCODE_BLOCK 4096
+
+static void bench_encode(void)
+{
+	static const int rates[] = { 8000, 16000, 48000 };
+	static const char *formats[] = { "u8", "s16", "u16", "float" };
+	static float buffer[ENCODE_BLOCK];
+	mdc_encoder_t *encoder;
+	mdc_int_t r, f, p, n;
+	double t, total;
+
+	for(r=0; r<(mdc_int_t)(sizeof(rates)/sizeof(rates[0])); r++)
+	{
+		encoder = mdc_encoder_new(rates[r]);
+		if(!encoder)
+		{
+			fprintf(stderr,"encode: create failed\n");
+			exit(-1);
+		}
+
+		for(f=0; f<4; f++)
+		{
+			total = 0;
+			t = now();
+			for(p=0; p<ENCODE_PACKETS; p++)
+			{
+				mdc_encoder_set_double_packet(encoder, 0x35, p & 0xff, 0x1000 + p, 1, 2, 3, 4);
+				for(;;)
+				{
+					switch(f)
+					{
+					case 0:
+						n = mdc_encoder_get_samples_u8(encoder, (unsigned char *)buffer, ENCODE_BLOCK);
+						break;
+					case 1:
+						n = mdc_encoder_get_samples_s16(encoder, (short *)buffer, ENCODE_BLOCK);
+						break;
+					case 2:
+						n = mdc_encoder_get_samples_u16(encoder, (unsigned short *)buffer, ENCODE_BLOCK);
+						break;
+					default:
+						n = mdc_encoder_get_samples_float(encoder, buffer, ENCODE_BLOCK);
+						break;
+					}
+					if(n <= 0)
+						break;
+					total += n;
+				}
+			}
+			t = now() - t;
+			sink += ((mdc_u8_t *)buffer)[0];
+
+			printf("encode %5d Hz %-5s: %7.1f Msamples/s  %5.2f ns/sample\n",
+			       rates[r], formats[f], total / t / 1e6, t * 1e9 / total);
+		}
+
+		mdc_encoder_destroy(encoder);
+	}
+}
+
+#define CACHE_IDS 16	// distinct packets sent over and over
+#define CACHE_SENDS 20000
+
+/*
+ * cost per packet of handing out the audio for a small set of repeated
+ * packets, encoded every time and then from the rendered packet cache
+ */
+static void bench_cache(void)
+{
+	static short buffer[ENCODE_BLOCK];
+	mdc_packet_cache_t *cache;
+	mdc_encoder_t *encoder;
+	const void *samples;
+	mdc_int_t p, n, total;
+	int len;
+	double t;
+
+	encoder = mdc_encoder_new(48000);
+	cache = mdc_packet_cache_new(CACHE_IDS);
+	if(!encoder || !cache)
+	{
+		fprintf(stderr,"cache: create failed\n");
+		exit(-1);
+	}
+
+	total = 0;
+	t = now();
+	for(p=0; p<CACHE_SENDS; p++)
+	{
+		mdc_encoder_set_preamble(encoder, 2);
+		mdc_encoder_set_packet(encoder, 0x01, 0x80, 0x1000 + p % CACHE_IDS);
+		while((n = mdc_encoder_get_samples_s16(encoder, buffer, ENCODE_BLOCK)) > 0)
+			total += n;
+	}
+	t = now() - t;
+	sink += buffer[0] + total;
+	printf("cache  encoded each time: %8.2f us/packet\n", t * 1e6 / CACHE_SENDS);
+
+	total = 0;
+	t = now();
+	for(p=0; p<CACHE_SENDS; p++)
+	{
+		samples = mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_S16, 2, 0x01, 0x80, 0x1000 + p % CACHE_IDS, &len);
+		total += ((const short *)samples)[len / 2];
+	}
+	t = now() - t;
+	sink += total;
+	printf("cache  from cache       : %8.2f us/packet  (%lu hits, %lu misses)\n",
+	       t * 1e6 / CACHE_SENDS, cache->hits, cache->misses);
+
+	mdc_packet_cache_destroy(cache);
+	mdc_encoder_destroy(encoder);
+}
+
+#define QUEUE_BURSTS 2000
+
+/*
+ * a status sweep: bursts of back to back packets queued on one encoder,
+ * each burst as many as the encoder holds, drained in ENCODE_BLOCK blocks
+ */
+static void bench_queue(void)
+{
+	static const int rates[] = { 8000, 16000, 48000 };
+	static short buffer[ENCODE_BLOCK];
+	mdc_encoder_t *encoder;
+	mdc_int_t r, b, p, n, sent;
+	double t, total;
+
+	for(r=0; r<(mdc_int_t)(sizeof(rates)/sizeof(rates[0])); r++)
+	{
+		encoder = mdc_encoder_new(rates[r]);
+		if(!encoder)
+		{
+			fprintf(stderr,"queue: create failed\n");
+			exit(-1);
+		}
+
+		sent = 0;
+		total = 0;
+		t = now();
+		for(b=0; b<QUEUE_BURSTS; b++)
+		{
+			for(p=0; p<=MDC_PACKETQ; p++)
+				sent += !mdc_encoder_queue_packet(encoder, 0x01, 0x80, 0x1000 + sent);
+			while((n = mdc_encoder_get_samples_s16(encoder, buffer, ENCODE_BLOCK)) > 0)
+				total += n;
+		}
+		t = now() - t;
+		sink += buffer[0];
+
+		printf("queue  %5d Hz: %9.0f packets/s  %7.1f Msamples/s\n",
+		       rates[r], sent / t, total / t / 1e6);
+
+		mdc_encoder_destroy(encoder);
+	}
+}
+
+static struct {
+	const char *name;
+	void (*fn)(void);
+} benches[] = {
+	{ "crc", bench_crc },
+	{ "ecc", bench_ecc },
+	{ "packet", bench_packet },
+	{ "pool", bench_pool },
+	{ "engine", bench_engine },
+	{ "bus", bench_bus },
+	{ "pll", bench_pll },
+	{ "encode", bench_encode },
+	{ "cache", bench_cache },
+	{ "queue", bench_queue },
+	{ (const char *)0L, 0L }
+};
+
+int main(int argc, char **argv)
+{
+	int i, j;
+
+	for(i=0; benches[i].name; i++)
+	{
+		if(argc > 1)
+		{
+			for(j=1; j<argc; j++)
+				if(!strcmp(argv[j], benches[i].name))
+					break;
+			if(j == argc)
+				continue;
+		}
+		(benches[i].fn)();
+	}
+
+	return 0;
+}
@@ -0,0 +1,166 @@
+/*-
+ * mdc_bus.c
+ *   Lock-free queue of decoded packets, published from decoding threads
+ *   and drained by consumer threads
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#include <stdlib.h>
+#include "mdc_bus.h"
+
+mdc_event_bus_t * mdc_event_bus_new(int capacity)
+{
+	mdc_event_bus_t *bus;
+	unsigned long i, size;
+
+	if(capacity < 1 || capacity > 0x40000000)
+		return (mdc_event_bus_t *) 0L;
+
+	for(size = 1; size < (unsigned long)capacity; size <<= 1)
+		;
+
+	bus = (mdc_event_bus_t *)calloc(1, sizeof(mdc_event_bus_t));
+	if(!bus)
+		return (mdc_event_bus_t *) 0L;
+
+	bus->cells = (mdc_event_bus_cell_t *)malloc(size * sizeof(mdc_event_bus_cell_t));
+	if(!bus->cells)
+	{
+		free(bus);
+		return (mdc_event_bus_t *) 0L;
+	}
+
+	// cell i is free for the publisher of position i
+	for(i=0; i<size; i++)
+		bus->cells[i].seq = i;
+	bus->mask = size - 1;
+
+	return bus;
+}
+
+void mdc_event_bus_destroy(mdc_event_bus_t *bus)
+{
+	if(!bus)
+		return;
+
+	free(bus->cells);
+	free(bus);
+}
+
+/*
+ * A cell's seq is its position when free for publishing, position + 1 once
+ * published, and position + capacity once consumed, which frees it for the
+ * publisher one lap later. Whoever wins the compare-and-swap on head (or
+ * tail) owns the cell until it advances seq.
+ */
+
+int mdc_event_bus_publish(mdc_event_bus_t *bus, const mdc_decoder_event_t *event)
+{
+	mdc_event_bus_cell_t *cell;
+	unsigned long pos, seq;
+	long diff;
+
+	if(!bus || !event)
+		return -1;
+
+	pos = __atomic_load_n(&bus->head, __ATOMIC_RELAXED);
+	for(;;)
+	{
+		cell = &bus->cells[pos & bus->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - pos);
+		if(diff == 0)
+		{
+			if(__atomic_compare_exchange_n(&bus->head, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if(diff < 0)
+		{
+			// a lap ahead of the consumers: full
+			__atomic_add_fetch(&bus->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		}
+		else
+			pos = __atomic_load_n(&bus->head, __ATOMIC_RELAXED);
+	}
+
+	cell->event = *event;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+void mdc_event_bus_event_callback(const mdc_decoder_event_t *event, void *context)
+{
+	mdc_event_bus_publish((mdc_event_bus_t *)context, event);
+}
+
+int mdc_event_bus_drain(mdc_event_bus_t *bus, mdc_decoder_event_t *events, int maxEvents)
+{
+	mdc_event_bus_cell_t *cell;
+	unsigned long pos, seq;
+	long diff;
+	int n;
+
+	if(!bus || maxEvents < 0 || (maxEvents && !events))
+		return -1;
+
+	pos = __atomic_load_n(&bus->tail, __ATOMIC_RELAXED);
+	for(n = 0; n < maxEvents; )
+	{
+		cell = &bus->cells[pos & bus->mask];
+		seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		diff = (long)(seq - (pos + 1));
+		if(diff == 0)
+		{
+			if(__atomic_compare_exchange_n(&bus->tail, &pos, pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+			{
+				events[n++] = cell->event;
+				__atomic_store_n(&cell->seq, pos + bus->mask + 1, __ATOMIC_RELEASE);
+				pos++;
+			}
+		}
+		else if(diff < 0)
+			break;	// empty, or the next packet is still being written
+		else
+			pos = __atomic_load_n(&bus->tail, __ATOMIC_RELAXED);
+	}
+
+	return n;
+}
+
+int mdc_event_bus_get_stats(mdc_event_bus_t *bus, unsigned long *published, unsigned long *dropped)
+{
+	if(!bus)
+		return -1;
+
+	if(published)
+		*published = __atomic_load_n(&bus->head, __ATOMIC_RELAXED);
+	if(dropped)
+		*dropped = __atomic_load_n(&bus->dropped, __ATOMIC_RELAXED);
+
+	return 0;
+}
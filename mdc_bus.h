@@ -0,0 +1,131 @@
+/*-
+ * mdc_bus.h
+ *  header for mdc_bus.c - a lock-free queue of decoded packets between threads
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#ifndef _MDC_BUS_H_
+#define _MDC_BUS_H_
+
+#include "mdc_decode.h"
+
+#ifndef MDC_CACHELINE
+ #define MDC_CACHELINE 64
+#endif
+
+/* one slot: seq says whose turn it is, publisher's or consumer's */
+typedef struct {
+	unsigned long seq;
+	mdc_decoder_event_t event;
+} mdc_event_bus_cell_t;
+
+/*
+ * a bounded multi-producer, multi-consumer ring (after Dmitry Vyukov's):
+ * publishers and consumers each claim a position with one compare-and-swap
+ * and never wait for each other. A full ring drops the new packet
+ */
+typedef struct {
+	mdc_event_bus_cell_t *cells;
+	unsigned long mask;	// capacity - 1, capacity a power of 2
+	mdc_u8_t pad0[MDC_CACHELINE];
+	unsigned long head;	// next position to publish to, so also the count published
+	mdc_u8_t pad1[MDC_CACHELINE - sizeof(unsigned long)];
+	unsigned long tail;	// next position to consume from
+	mdc_u8_t pad2[MDC_CACHELINE - sizeof(unsigned long)];
+	unsigned long dropped;
+} mdc_event_bus_t;
+
+
+/*
+ mdc_event_bus_new
+ create an event bus
+
+  parameters: int capacity - packets held before publishers start dropping,
+                             rounded up to a power of 2
+
+  returns: an mdc_event_bus object or null if failure
+
+*/
+mdc_event_bus_t * mdc_event_bus_new(int capacity);
+
+/*
+ mdc_event_bus_destroy
+ free an event bus; no thread may be using it
+
+  parameters: mdc_event_bus_t *bus - pointer to the bus object
+*/
+void mdc_event_bus_destroy(mdc_event_bus_t *bus);
+
+/*
+ mdc_event_bus_publish
+ add a packet to the bus, from any thread. Never blocks: if the bus is
+ full the packet is dropped and counted
+
+  parameters: mdc_event_bus_t *bus - pointer to the bus object
+              mdc_decoder_event_t *event - the packet to copy in
+
+  returns: -1 if dropped or error, 0 otherwise
+*/
+int mdc_event_bus_publish(mdc_event_bus_t *bus, const mdc_decoder_event_t *event);
+
+/*
+ mdc_event_bus_event_callback
+ an mdc_decoder_event_callback_t that publishes to the bus given as its
+ context: mdc_decoder_set_event_callback(decoder, mdc_event_bus_event_callback, bus)
+ sends that decoder's packets to the bus instead of handling them on the
+ decoding thread
+
+  parameters: mdc_decoder_event_t *event - the packet
+              void *context - pointer to the bus object
+*/
+void mdc_event_bus_event_callback(const mdc_decoder_event_t *event, void *context);
+
+/*
+ mdc_event_bus_drain
+ take packets off the bus, oldest first, from any thread. Packets from one
+ publisher come off in the order it published them
+
+  parameters: mdc_event_bus_t *bus - pointer to the bus object
+              mdc_decoder_event_t *events - array to store packets in
+              int maxEvents - size of the events array
+
+  returns: -1 if error, otherwise the number of packets stored
+*/
+int mdc_event_bus_drain(mdc_event_bus_t *bus, mdc_decoder_event_t *events, int maxEvents);
+
+/*
+ mdc_event_bus_get_stats
+ retrieve the bus counters
+
+  parameters: mdc_event_bus_t *bus - pointer to the bus object
+              unsigned long *published - pointer to where to store the number of packets published
+              unsigned long *dropped - pointer to where to store the number dropped because the bus was full
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_event_bus_get_stats(mdc_event_bus_t *bus, unsigned long *published, unsigned long *dropped);
+
+#endif
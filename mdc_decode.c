@@ -33,157 +33,381 @@
 -*/
 
 #include <stdlib.h>
+#include <stddef.h>
 #include "mdc_decode.h"
 #include "mdc_common.c"
 
-mdc_decoder_t * mdc_decoder_new(int sampleRate)
+#ifdef MDC_SIMD
+#ifdef __AVX2__
+#include <immintrin.h>
+#else
+#include <emmintrin.h>
+#endif
+#endif
+
+#if defined(MDC_ONEPOINT)
+#define MDC_STEPMUL 1	// unit phase wraps once per bit
+#elif defined(MDC_FOURPOINT)
+#define MDC_STEPMUL 5	// unit phase wraps five times per bit
+#else
+#error "no decode strategy chosen"
+#endif
+
+#define MDC_SYNC 0x07092a446fULL	// 40-bit sync word
+#define MDC_SYNCMASK 0xffffffffffULL
+
+static int _onebits_sw(mdc_u64_t n)
+{
+	n = n - ((n >> 1) & 0x5555555555555555ULL);
+	n = (n & 0x3333333333333333ULL) + ((n >> 2) & 0x3333333333333333ULL);
+	n = (n + (n >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+	return (int)((n * 0x0101010101010101ULL) >> 56);
+}
+
+#if defined(__POPCNT__)
+
+// built for a CPU with a popcount instruction, no need to check at runtime
+#define _onebits(n) __builtin_popcountll(n)
+static void _onebits_init(void) { }
+
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+
+__attribute__((target("popcnt")))
+static int _onebits_hw(mdc_u64_t n)
+{
+	return __builtin_popcountll(n);
+}
+
+static int (*_onebits)(mdc_u64_t n) = _onebits_sw;
+
+// pick the popcount instruction if this CPU has it; only the first call
+// writes, so decoders set up later on other threads just read the choice
+static void _onebits_init(void)
+{
+	if(_onebits != _onebits_sw)
+		return;
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("popcnt"))
+		_onebits = _onebits_hw;
+}
+
+#else
+
+#define _onebits(n) _onebits_sw(n)
+static void _onebits_init(void) { }
+
+#endif
+
+#define _CONFIG(rate, incru) { rate, incru, MDC_STEPMUL * (mdc_u32_t)(incru), \
+                             0xffffffff / (MDC_STEPMUL * (mdc_u32_t)(incru)), MDC_GDTHRESH, \
+                             (0xffffffff / (MDC_STEPMUL * (mdc_u32_t)(incru))) >= MDC_EVENTGAP }
+
+// shared by all decoders at these rates
+static const mdc_decoder_config_t _configs[] = {
+	_CONFIG(8000, 644245094),
+	_CONFIG(16000, 322122547),
+	_CONFIG(22050, 233739716),
+	_CONFIG(32000, 161061274),
+	_CONFIG(44100, 116869858),
+	_CONFIG(48000, 107374182)
+};
+
+int mdc_decoder_config_init(mdc_decoder_config_t *config, int sampleRate)
 {
-	mdc_decoder_t *decoder;
 	mdc_int_t i;
 
-	decoder = (mdc_decoder_t *)malloc(sizeof(mdc_decoder_t));
-	if(!decoder)
-		return (mdc_decoder_t *) 0L;
+	// each decode unit's phase must advance less than a full turn per sample
+	if(!config || sampleRate <= 1200 * MDC_STEPMUL)
+		return -1;
+
+	_onebits_init();
 
 //	decoder->hyst = 3.0/256.0; - deprecated (zerocrossing)
 //	decoder->incr = (1200.0 * TWOPI) / ((mdc_float_t)sampleRate);
 
-	if(sampleRate == 8000)
-	{
-		decoder->incru = 644245094;
-	} else if(sampleRate == 16000)
-	{
-		decoder->incru = 322122547;
-	} else if(sampleRate == 22050)
-	{
-		decoder->incru = 233739716;
-	} else if(sampleRate == 32000)
+	for(i=0; i<(mdc_int_t)(sizeof(_configs) / sizeof(_configs[0])); i++)
 	{
-		decoder->incru = 161061274;
-	} else if(sampleRate == 44100)
-	{
-		decoder->incru = 116869858;
-	} else if(sampleRate == 48000)
-	{
-		decoder->incru = 107374182;
-	} else
+		if(_configs[i].sampleRate == sampleRate)
+		{
+			*config = _configs[i];
+			return 0;
+		}
+	}
+
+	config->sampleRate = sampleRate;
+	// WARNING: lower precision than above
+	config->incru = 1200 * 2 * (0x80000000 / sampleRate);
+	config->step = MDC_STEPMUL * config->incru;
+	config->gap = 0xffffffff / config->step;
+	config->syncThreshold = MDC_GDTHRESH;
+	// skip from wrap to wrap when units wrap rarely enough for that to pay off
+	config->eventdriven = config->gap >= MDC_EVENTGAP;
+
+	return 0;
+}
+
+static const mdc_decoder_config_t * _shared_config(int sampleRate)
+{
+	mdc_int_t i;
+
+	for(i=0; i<(mdc_int_t)(sizeof(_configs) / sizeof(_configs[0])); i++)
 	{
-		// WARNING: lower precision than above
-		decoder->incru = 1200 * 2 * (0x80000000 / sampleRate);
+		if(_configs[i].sampleRate == sampleRate)
+			return &_configs[i];
 	}
 
-	decoder->good = 0;
+	return (const mdc_decoder_config_t *) 0L;
+}
+
+// set up a decoder in given memory, in its post-construction state
+static void _decoder_init(mdc_decoder_t *decoder, const mdc_decoder_config_t *config)
+{
+	mdc_int_t i;
+#ifdef MDC_FOURPOINT
+	mdc_int_t j;
+#endif
+
+	_onebits_init();
+
+	decoder->config = config;
+
 	decoder->indouble = 0;
-	decoder->level = 0;
 
+	decoder->channel = 0;
+	decoder->sample = 0;
+	decoder->now = 0;
+	decoder->syncat = 0;
+	decoder->tsbase = 0;
+	decoder->tssample = 0;
+	decoder->tsrate = 0;
+
+	decoder->evhead = 0;
+	decoder->evtail = 0;
+	decoder->evdecoded = 0;
+	decoder->evdropped = 0;
+
+	decoder->gate_level = 0;
+	decoder->gate_hang = 0;
+	decoder->gate_idle = 0;
+	decoder->gate_blocks = 0;
+	decoder->gate_skipped = 0;
+
+
+	for(i=0; i<MDC_NDV; i++)
+		decoder->thu[i] = 0;
 
 	for(i=0; i<MDC_ND; i++)
 	{
-		decoder->du[i].thu = i * 2 * (0x80000000 / MDC_ND);
+		decoder->thu[i] = i * 2 * (0x80000000 / MDC_ND);
 		decoder->du[i].xorb = 0;
 		decoder->du[i].invert = 0;
 		decoder->du[i].shstate = -1;
 		decoder->du[i].shcount = 0;
+		decoder->du[i].syncat = 0;
 	#ifdef MDC_FOURPOINT
-		decoder->du[i].nlstep = i;
+		decoder->nlstep[i] = i;
+		for(j=0; j<10; j++)
+			decoder->nlevel[j][i] = 0;
 	#endif
 	}
 
+#ifdef MDC_FOURPOINT
+	decoder->pll = 0;
+#endif
+
 	decoder->callback = (mdc_decoder_callback_t)0L;
+	decoder->event_callback = (mdc_decoder_event_callback_t)0L;
+}
+
+// a shared config for standard rates, otherwise one of the decoder's own
+static int _decoder_init_rate(mdc_decoder_t *decoder, int sampleRate)
+{
+	const mdc_decoder_config_t *config = _shared_config(sampleRate);
+
+	if(!config)
+	{
+		if(mdc_decoder_config_init(&decoder->ownconfig, sampleRate))
+			return -1;
+		config = &decoder->ownconfig;
+	}
+
+	_decoder_init(decoder, config);
+
+	return 0;
+}
+
+mdc_decoder_t * mdc_decoder_new(int sampleRate)
+{
+	mdc_decoder_t *decoder;
+
+	decoder = (mdc_decoder_t *)malloc(sizeof(mdc_decoder_t));
+	if(!decoder)
+		return (mdc_decoder_t *) 0L;
+
+	if(_decoder_init_rate(decoder, sampleRate))
+	{
+		free(decoder);
+		return (mdc_decoder_t *) 0L;
+	}
+	decoder->allocated = 1;
+
+	return decoder;
+}
+
+struct _mdc_decoder_align { char c; mdc_decoder_t d; };
+
+int mdc_decoder_sizeof(void)
+{
+	return sizeof(mdc_decoder_t);
+}
+
+int mdc_decoder_alignof(void)
+{
+	return offsetof(struct _mdc_decoder_align, d);
+}
+
+mdc_decoder_t * mdc_decoder_init(void *mem, int sampleRate)
+{
+	mdc_decoder_t *decoder = (mdc_decoder_t *)mem;
+
+	if(!mem || ((size_t)mem) % mdc_decoder_alignof())
+		return (mdc_decoder_t *) 0L;
+
+	if(_decoder_init_rate(decoder, sampleRate))
+		return (mdc_decoder_t *) 0L;
+	decoder->allocated = 0;
+
+	return decoder;
+}
+
+mdc_decoder_t * mdc_decoder_init_config(void *mem, const mdc_decoder_config_t *config)
+{
+	mdc_decoder_t *decoder = (mdc_decoder_t *)mem;
+
+	if(!mem || ((size_t)mem) % mdc_decoder_alignof() || !config)
+		return (mdc_decoder_t *) 0L;
+
+	_decoder_init(decoder, config);
+	decoder->allocated = 0;
 
 	return decoder;
 }
 
+int mdc_decoder_reset(mdc_decoder_t *decoder)
+{
+	mdc_int_t allocated, channel;
+
+	if(!decoder)
+		return -1;
+
+	allocated = decoder->allocated;
+	channel = decoder->channel;
+	_decoder_init(decoder, decoder->config);
+	decoder->allocated = allocated;
+	decoder->channel = channel;
+
+	return 0;
+}
+
+void mdc_decoder_destroy(mdc_decoder_t *decoder)
+{
+	if(decoder && decoder->allocated)
+		free(decoder);
+}
+
 static void _clearbits(mdc_decoder_t *decoder, mdc_int_t x)
 {
-	mdc_int_t i;
-	for(i=0; i<112; i++)
-		decoder->du[x].bits[i] = 0;
+	decoder->du[x].bits[0] = 0;
+	decoder->du[x].bits[1] = 0;
 }
 
-#ifdef MDC_ECC
-static void _gofix(unsigned char *data)
+/*
+ * the 112 bits of a frame are sent as 16 columns of 7; received bit k
+ * belongs at position (k%16)*7 + k/16 of the de-interleaved frame
+ */
+static const mdc_u8_t _deinterleave[112] = {
+	  0,   7,  14,  21,  28,  35,  42,  49,  56,  63,  70,  77,  84,  91,  98, 105,
+	  1,   8,  15,  22,  29,  36,  43,  50,  57,  64,  71,  78,  85,  92,  99, 106,
+	  2,   9,  16,  23,  30,  37,  44,  51,  58,  65,  72,  79,  86,  93, 100, 107,
+	  3,  10,  17,  24,  31,  38,  45,  52,  59,  66,  73,  80,  87,  94, 101, 108,
+	  4,  11,  18,  25,  32,  39,  46,  53,  60,  67,  74,  81,  88,  95, 102, 109,
+	  5,  12,  19,  26,  33,  40,  47,  54,  61,  68,  75,  82,  89,  96, 103, 110,
+	  6,  13,  20,  27,  34,  41,  48,  55,  62,  69,  76,  83,  90,  97, 104, 111 };
+
+
+static mdc_u64_t _timestamp(mdc_decoder_t *decoder, mdc_u64_t sample)
 {
-	int i, j, b, k;
-	int csr[7];
-	int syn;
-	int fixi,fixj;
-	int ec;
-	
-	syn = 0;
-	for(i=0; i<7; i++)
-		csr[i] = 0;
+	mdc_u64_t d, r, t;
+	mdc_u64_t rate = decoder->config->sampleRate;
 
-	for(i=0; i<7; i++)
-	{
-		for(j=0; j<=7; j++)
-		{
-			for(k=6; k > 0; k--)
-				csr[k] = csr[k-1];
+	if(!decoder->tsrate)
+		return 0;
 
-			csr[0] = (data[i] >> j) & 0x01;
-			b = csr[0] + csr[2] + csr[5] + csr[6];
-			syn <<= 1;
-			if( (b & 0x01) ^ ((data[i+7] >> j) & 0x01) )
-			{
-				syn |= 1;
-			}
-			ec = 0;
-			if(syn & 0x80) ++ec;
-			if(syn & 0x20) ++ec;
-			if(syn & 0x04) ++ec;
-			if(syn & 0x02) ++ec;
-			if(ec >= 3)
-			{
-				syn ^= 0xa6;
-				fixi = i;
-				fixj = j-7;
-				if(fixj < 0)
-				{
-					--fixi;
-					fixj += 8;
-				}
-				if(fixi >= 0)
-					data[fixi] ^= 1<<fixj; // flip
-			}
-		}
-	}
+	// a packet can sync before the anchor is moved and end after it, so
+	// count back from the anchor too; either way, round towards earlier
+	if(sample >= decoder->tssample)
+		d = sample - decoder->tssample;
+	else
+		d = decoder->tssample - sample;
 
+	// split so that d * tsrate cannot overflow
+	r = (d % rate) * decoder->tsrate;
+	t = (d / rate) * decoder->tsrate + r / rate;
 
+	if(sample >= decoder->tssample)
+		return decoder->tsbase + t;
+	return decoder->tsbase - t - (r % rate != 0);
+}
+
+static void _make_event(mdc_decoder_t *decoder, mdc_int_t frameCount, mdc_decoder_event_t *ev)
+{
+	ev->frameCount = frameCount;
+	ev->op = decoder->op;
+	ev->arg = decoder->arg;
+	ev->unitID = decoder->unitID;
+	ev->extra0 = frameCount == 2 ? decoder->extra0 : 0;
+	ev->extra1 = frameCount == 2 ? decoder->extra1 : 0;
+	ev->extra2 = frameCount == 2 ? decoder->extra2 : 0;
+	ev->extra3 = frameCount == 2 ? decoder->extra3 : 0;
+	ev->channel = decoder->channel;
+	ev->syncSample = decoder->syncat;
+	ev->endSample = decoder->now;
+	ev->syncTime = _timestamp(decoder, decoder->syncat);
+	ev->endTime = _timestamp(decoder, decoder->now);
 }
-#endif
 
+static void _push_event(mdc_decoder_t *decoder, mdc_int_t frameCount)
+{
+	if(decoder->evhead - decoder->evtail == MDC_EVENTQ)
+	{
+		// full: the oldest unread packet makes way
+		decoder->evtail++;
+		decoder->evdropped++;
+	}
+
+	_make_event(decoder, frameCount, &decoder->events[decoder->evhead % MDC_EVENTQ]);
+	decoder->evhead++;
+}
+
+// frame count of the oldest unread packet, or 0 if none
+static mdc_int_t _pending(mdc_decoder_t *decoder)
+{
+	if(decoder->evhead == decoder->evtail)
+		return 0;
+
+	return decoder->events[decoder->evtail % MDC_EVENTQ].frameCount;
+}
 
 static void _procbits(mdc_decoder_t *decoder, int x)
 {
-	mdc_int_t lbits[112];
-	mdc_int_t lbc = 0;
-	mdc_int_t i, j, k;
+	mdc_int_t i, k;
+	mdc_int_t good = 0;
 	mdc_u8_t data[14];
 	mdc_u16_t ccrc;
 	mdc_u16_t rcrc;
 
-	for(i=0; i<16; i++)
-	{
-		for(j=0; j<7; j++)
-		{
-			k = (j*16) + i;
-			lbits[lbc] = decoder->du[x].bits[k];
-			++lbc;
-		}
-	}
-
 	for(i=0; i<14; i++)
-	{
-		data[i] = 0;
-		for(j=0; j<8; j++)
-		{
-			k = (i*8)+j;
-
-			if(lbits[k])
-				data[i] |= 1<<j;
-		}
-	}
+		data[i] = (mdc_u8_t)(decoder->du[x].bits[i >> 3] >> ((i & 7) * 8));
 
 
 #ifdef MDC_ECC
@@ -206,7 +430,7 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 			for(k=0; k<MDC_ND; k++)
 				decoder->du[k].shstate = -1;
 
-			decoder->good = 2;
+			good = 2;
 			decoder->indouble = 0;
 
 		}
@@ -214,7 +438,8 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 		{
 			if(!decoder->indouble)
 			{
-				decoder->good = 1;
+				good = 1;
+				decoder->syncat = decoder->du[x].syncat;
 				decoder->op = data[0];
 				decoder->arg = data[1];
 				decoder->unitID = (data[2] << 8) | data[3];
@@ -224,7 +449,7 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 				/* list of opcode that mean 'double packet' */
 				case 0x35:
 				case 0x55:
-					decoder->good = 0;
+					good = 0;
 					decoder->indouble = 1;
 					decoder->du[x].shstate = 2;
 					decoder->du[x].shcount = 0;
@@ -252,11 +477,20 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 		decoder->du[x].shstate = -1;
 	}
 
-	if(decoder->good)
+	if(good)
 	{
-		if(decoder->callback)
+		decoder->evdecoded++;
+
+		if(decoder->event_callback)
+		{
+			mdc_decoder_event_t ev;
+
+			_make_event(decoder, good, &ev);
+			(decoder->event_callback)(&ev, decoder->event_callback_context);
+		}
+		else if(decoder->callback)
 		{
-			(decoder->callback)( (int)decoder->good,
+			(decoder->callback)( (int)good,
 								(unsigned char)decoder->op,
 								(unsigned char)decoder->arg,
 								(unsigned short)decoder->unitID,
@@ -265,24 +499,15 @@ static void _procbits(mdc_decoder_t *decoder, int x)
 								(unsigned char)decoder->extra2,
 								(unsigned char)decoder->extra3,
 								decoder->callback_context);
-			decoder->good = 0;
-
+		}
+		else
+		{
+			_push_event(decoder, good);
 		}
 	}
 }
 
 
-static int _onebits(mdc_u32_t n)
-{
-	int i=0;
-	while(n)
-	{
-		++i;
-		n &= (n-1);
-	}
-	return i;
-}
-
 static void _shiftin(mdc_decoder_t *decoder, int x)
 {
 	int bit = decoder->du[x].xorb;
@@ -291,41 +516,40 @@ static void _shiftin(mdc_decoder_t *decoder, int x)
 	switch(decoder->du[x].shstate)
 	{
 	case -1:
-		decoder->du[x].synchigh = 0;
-		decoder->du[x].synclow = 0;
+		decoder->du[x].sync = 0;
 		decoder->du[x].shstate = 0;
 		// deliberately fall through
 	case 0:
-		decoder->du[x].synchigh <<= 1;
-		if(decoder->du[x].synclow & 0x80000000)
-			decoder->du[x].synchigh |= 1;
-		decoder->du[x].synclow <<= 1;
-		if(bit)
-			decoder->du[x].synclow |= 1;
+		decoder->du[x].sync = (decoder->du[x].sync << 1) | (bit ? 1 : 0);
 
-		gcount = _onebits(0x000000ff & (0x00000007 ^ decoder->du[x].synchigh));
-		gcount += _onebits(0x092a446f ^ decoder->du[x].synclow);
+		gcount = _onebits(MDC_SYNCMASK & (MDC_SYNC ^ decoder->du[x].sync));
 
-		if(gcount <= MDC_GDTHRESH)
+		if(gcount <= decoder->config->syncThreshold)
 		{
  //printf("sync %d  %x %x \n",gcount,decoder->du[x].synchigh, decoder->du[x].synclow);
 			decoder->du[x].shstate = 1;
 			decoder->du[x].shcount = 0;
+			decoder->du[x].syncat = decoder->now;
 			_clearbits(decoder, x);
 		}
-		else if(gcount >= (40 - MDC_GDTHRESH))
+		else if(gcount >= (40 - decoder->config->syncThreshold))
 		{
  //printf("isync %d\n",gcount);
 			decoder->du[x].shstate = 1;
 			decoder->du[x].shcount = 0;
 			decoder->du[x].xorb = !(decoder->du[x].xorb);
 			decoder->du[x].invert = !(decoder->du[x].invert);
+			decoder->du[x].syncat = decoder->now;
 			_clearbits(decoder, x);
 		}
 		return;
 	case 1:
 	case 2:
-		decoder->du[x].bits[decoder->du[x].shcount] = bit;
+		if(bit)
+		{
+			mdc_int_t p = _deinterleave[decoder->du[x].shcount];
+			decoder->du[x].bits[p >> 6] |= ((mdc_u64_t)1) << (p & 63);
+		}
 		decoder->du[x].shcount++;
 		if(decoder->du[x].shcount > 111)
 		{
@@ -340,157 +564,800 @@ static void _shiftin(mdc_decoder_t *decoder, int x)
 
 #ifdef MDC_FOURPOINT
 
+#ifdef MDC_FIXEDMATH
+/*
+ * the same four-point weights, -0.60 and .97, scaled by 100 so that they
+ * are exact integers; only the comparison of vnow and vpast matters, so
+ * the scale makes no difference to the decision
+ */
+#define MDC_NLW1 (-60)
+#define MDC_NLW2 97
+#endif
+
 static void _nlproc(mdc_decoder_t *decoder, int x)
 {
+#ifdef MDC_FIXEDMATH
+	mdc_int_t vnow;
+	mdc_int_t vpast;
+
+	switch(decoder->nlstep[x])
+	{
+	case 3:
+		vnow = (MDC_NLW1 * decoder->nlevel[3][x]) + (MDC_NLW2 * decoder->nlevel[1][x]);
+		vpast = (MDC_NLW1 * decoder->nlevel[7][x]) + (MDC_NLW2 * decoder->nlevel[9][x]);
+		break;
+	case 8:
+		vnow = (MDC_NLW1 * decoder->nlevel[8][x]) + (MDC_NLW2 * decoder->nlevel[6][x]);
+		vpast = (MDC_NLW1 * decoder->nlevel[2][x]) + (MDC_NLW2 * decoder->nlevel[4][x]);
+		break;
+	default:
+		return;
+	}
+#else
 	mdc_float_t vnow;
 	mdc_float_t vpast;
 
-	switch(decoder->du[x].nlstep)
+	switch(decoder->nlstep[x])
 	{
 	case 3:
-		vnow = ((-0.60 * decoder->du[x].nlevel[3]) + (.97 * decoder->du[x].nlevel[1]));
-		vpast = ((-0.60 * decoder->du[x].nlevel[7]) + (.97 * decoder->du[x].nlevel[9]));
+		vnow = ((-0.60 * decoder->nlevel[3][x]) + (.97 * decoder->nlevel[1][x]));
+		vpast = ((-0.60 * decoder->nlevel[7][x]) + (.97 * decoder->nlevel[9][x]));
 		break;
 	case 8:
-		vnow = ((-0.60 * decoder->du[x].nlevel[8]) + (.97 * decoder->du[x].nlevel[6]));
-		vpast = ((-0.60 * decoder->du[x].nlevel[2]) + (.97 * decoder->du[x].nlevel[4]));
+		vnow = ((-0.60 * decoder->nlevel[8][x]) + (.97 * decoder->nlevel[6][x]));
+		vpast = ((-0.60 * decoder->nlevel[2][x]) + (.97 * decoder->nlevel[4][x]));
 		break;
 	default:
 		return;
 	}
+#endif // MDC_FIXEDMATH
 
 	decoder->du[x].xorb = (vnow > vpast) ? 1 : 0;
 	if(decoder->du[x].invert)
 		decoder->du[x].xorb = !(decoder->du[x].xorb);
 	_shiftin(decoder, x);
 }
-#endif
 
-int mdc_decoder_process_samples(mdc_decoder_t *decoder,
-                                mdc_sample_t *samples,
-                                int numSamples)
-{
-	mdc_int_t i, j;
-	mdc_sample_t sample;
-#ifndef MDC_FIXEDMATH
-	mdc_float_t value;
-#else
-	mdc_int_t value;
+/*
+ * PLL mode: the same decision, made one sample point later so that the
+ * points a fifth of a bit either side of it are in hand too. Their
+ * decision strengths act as an early-late gate, pulling the units' shared
+ * clock towards the weaker side; that settles on the decision point with
+ * the widest eye. Each unit holds its last correction of up to
+ * 1/2^MDC_PLLGAIN of a bit per bit, split between the units, and halves
+ * it once it is inside a frame to hold the timing against noise. Returns
+ * 1 if the correction was updated
+ */
+#ifndef MDC_PLLGAIN
+ #define MDC_PLLGAIN 6
 #endif
 
-	if(!decoder)
-		return -1;
-
-	for(i = 0; i<numSamples; i++)
-	{
-		sample = samples[i];
+#define _NL(k) decoder->nlevel[((k) + 10) % 10][x]
 
 #ifdef MDC_FIXEDMATH
-#if defined(MDC_SAMPLE_FORMAT_U8)
-		value = ((mdc_int_t)sample) - 127;
-#elif defined(MDC_SAMPLE_FORMAT_U16)
-		value = ((mdc_int_t)sample) - 32767;
-#elif defined(MDC_SAMPLE_FORMAT_S16)
-		value = (mdc_int_t) sample;
-#elif defined(MDC_SAMPLE_FORMAT_FLOAT)
-#error "fixed-point math not allowed with float sample format"
+#define _FOURPOINT(c) ((MDC_NLW1 * _NL(c) + MDC_NLW2 * _NL((c) - 2)) - (MDC_NLW1 * _NL((c) + 4) + MDC_NLW2 * _NL((c) + 6)))
 #else
-#error "no known sample format set"
-#endif // sample format
-
-#endif // is MDC_FIXEDMATH
+#define _FOURPOINT(c) (((-0.60 * _NL(c)) + (.97 * _NL((c) - 2))) - ((-0.60 * _NL((c) + 4)) + (.97 * _NL((c) + 6))))
+#endif
 
-#ifndef MDC_FIXEDMATH
-#if defined(MDC_SAMPLE_FORMAT_U8)
-		value = (((mdc_float_t)sample) - 128.0)/256;
-#elif defined(MDC_SAMPLE_FORMAT_U16)
-		value = (((mdc_float_t)sample) - 32768.0)/65536.0;
-#elif defined(MDC_SAMPLE_FORMAT_S16)
-		value = ((mdc_float_t)sample) / 65536.0;
-#elif defined(MDC_SAMPLE_FORMAT_FLOAT)
-		value = sample;
+static int _pllproc(mdc_decoder_t *decoder, int x)
+{
+	mdc_s32 k = (decoder->config->step >> (MDC_PLLGAIN + (decoder->du[x].shstate > 0))) / decoder->pll;
+#ifdef MDC_FIXEDMATH
+	mdc_int_t on, early, late;
 #else
-#error "no known sample format set"
-#endif // sample format
-#endif // not MDC_FIXEDMATH
-
-#if defined(MDC_ONEPOINT)
+	mdc_float_t on, early, late;
+#endif
 
-		for(j=0; j<MDC_ND; j++)
-		{
-			mdc_u32_t lthu = decoder->du[j].thu;
-			decoder->du[j].thu += decoder->incru;
-			if(decoder->du[j].thu < lthu) // wrapped
-			{
-				if(value > 0)
-					decoder->du[j].xorb = 1;
-				else
-					decoder->du[j].xorb = 0;
-				if(decoder->du[j].invert)
-					decoder->du[j].xorb = !(decoder->du[j].xorb);
-				_shiftin(decoder, j);
-			}
-		}
+	switch(decoder->nlstep[x])
+	{
+	case 4:
+		on = _FOURPOINT(3);
+		early = _FOURPOINT(2);
+		late = _FOURPOINT(4);
+		break;
+	case 9:
+		on = _FOURPOINT(8);
+		early = _FOURPOINT(7);
+		late = _FOURPOINT(9);
+		break;
+	default:
+		return 0;
+	}
 
-#elif defined(MDC_FOURPOINT)
+	early = early < 0 ? -early : early;
+	late = late < 0 ? -late : late;
 
+	// a stronger early decision means sampling later: a smaller step
+	decoder->pllerr[x] = 0;
+	if(early + late > 0)
 #ifdef MDC_FIXEDMATH
-#error "fixed-point math not allowed for fourpoint strategy"
+		decoder->pllerr[x] = (mdc_s32)(((long long)k * (late - early)) / (late + early));
+#else
+		decoder->pllerr[x] = (mdc_s32)(k * (late - early) / (late + early));
 #endif
 
-		for(j=0; j<MDC_ND; j++)
-		{
-			//decoder->du[j].th += (5.0 * decoder->incr);
-			mdc_u32_t lthu = decoder->du[j].thu;
-			decoder->du[j].thu += 5 * decoder->incru;
-		//	if(decoder->du[j].th >= TWOPI)
-			if(decoder->du[j].thu < lthu) // wrapped
-			{
-				decoder->du[j].nlstep++;
-				if(decoder->du[j].nlstep > 9)
-					decoder->du[j].nlstep = 0;
-				decoder->du[j].nlevel[decoder->du[j].nlstep] = value;	
+	decoder->du[x].xorb = (on > 0) ? 1 : 0;
+	if(decoder->du[x].invert)
+		decoder->du[x].xorb = !(decoder->du[x].xorb);
+	_shiftin(decoder, x);
+	return 1;
+}
 
-				_nlproc(decoder, j);
+// the shared clock: the nominal step plus every unit's correction
+static mdc_u32_t _pllstep(mdc_decoder_t *decoder)
+{
+	mdc_u32_t step = decoder->config->step;
+	mdc_int_t j;
 
-				//decoder->du[j].th -= TWOPI;
-			}
-		}
+	for(j=0; j<decoder->pll; j++)
+		step += decoder->pllerr[j];
+	return step;
+}
 
-#else
-#error "no decode strategy chosen"
+#undef _FOURPOINT
+#undef _NL
 #endif
-	}
-
-	
 
-	if(decoder->good)
-		return decoder->good;
+/*
+ * advance the phase of every decode unit by incr, returning a bitmask
+ * (bit j for unit j) of the units whose phase wrapped on this sample
+ */
+static mdc_u32_t _advance_units(mdc_decoder_t *decoder, mdc_u32_t incr)
+{
+	mdc_u32_t mask;
+#if defined(MDC_SIMD) && defined(__AVX2__)
+	__m256i bias = _mm256_set1_epi32((int)0x80000000);
+	__m256i o = _mm256_loadu_si256((__m256i *)decoder->thu);
+	__m256i n = _mm256_add_epi32(o, _mm256_set1_epi32((int)incr));
+
+	_mm256_storeu_si256((__m256i *)decoder->thu, n);
+	// unsigned new < old, done as a signed compare on sign-flipped values
+	mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(_mm256_xor_si256(o, bias), _mm256_xor_si256(n, bias))));
+#elif defined(MDC_SIMD)
+	__m128i bias = _mm_set1_epi32((int)0x80000000);
+	__m128i step = _mm_set1_epi32((int)incr);
+	__m128i o0 = _mm_loadu_si128((__m128i *)decoder->thu);
+	__m128i o1 = _mm_loadu_si128((__m128i *)(decoder->thu + 4));
+	__m128i n0 = _mm_add_epi32(o0, step);
+	__m128i n1 = _mm_add_epi32(o1, step);
+
+	_mm_storeu_si128((__m128i *)decoder->thu, n0);
+	_mm_storeu_si128((__m128i *)(decoder->thu + 4), n1);
+	// unsigned new < old, done as a signed compare on sign-flipped values
+	mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_xor_si128(o0, bias), _mm_xor_si128(n0, bias))));
+	mask |= _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(_mm_xor_si128(o1, bias), _mm_xor_si128(n1, bias)))) << 4;
+#else
+	mdc_int_t j;
 
-	return 0;
+	mask = 0;
+	for(j=0; j<MDC_ND; j++)
+	{
+		mdc_u32_t lthu = decoder->thu[j];
+		decoder->thu[j] += incr;
+		if(decoder->thu[j] < lthu) // wrapped
+			mask |= 1 << j;
+	}
+#endif
+	return mask & ((1 << MDC_ND) - 1);
 }
 
-int mdc_decoder_get_packet(mdc_decoder_t *decoder, 
-                           unsigned char *op,
+static mdc_int_t _lowbit(mdc_u32_t mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(mask);
+#else
+	mdc_int_t j = 0;
+	while(!(mask & 1))
+	{
+		mask >>= 1;
+		++j;
+	}
+	return j;
+#endif
+}
+
+/*
+ * input samples are converted to the decoder's internal level type a block at a
+ * time, with one simple loop per format that the compiler can vectorize
+ */
+#ifdef MDC_FIXEDMATH
+typedef mdc_int_t mdc_value_t;
+#define _VALUE_U8(s) ((((mdc_int_t)(s)) - 127) * 256)	// all formats on a 16-bit scale
+#define _VALUE_U16(s) (((mdc_int_t)(s)) - 32767)
+#define _VALUE_S16(s) ((mdc_int_t)(s))
+#define _VALUE_FLOAT(s) ((s) > 1.0f ? 32767 : (s) >= -1.0f ? (mdc_int_t)((s) * 32767.0f) : -32767)	// clamped, NaN to -1
+#else
+typedef mdc_float_t mdc_value_t;
+#define _VALUE_U8(s) ((((mdc_float_t)(s)) - 128.0)/256)	// all formats full scale at +/-0.5
+#define _VALUE_U16(s) ((((mdc_float_t)(s)) - 32768.0)/65536.0)
+#define _VALUE_S16(s) (((mdc_float_t)(s)) / 65536.0)
+#define _VALUE_FLOAT(s) (((mdc_float_t)(s)) * 0.5)
+#endif // MDC_FIXEDMATH
+
+#if defined(MDC_SAMPLE_FORMAT_U8)
+#define _VALUE_SAMPLE(s) _VALUE_U8(s)
+#elif defined(MDC_SAMPLE_FORMAT_U16)
+#define _VALUE_SAMPLE(s) _VALUE_U16(s)
+#elif defined(MDC_SAMPLE_FORMAT_S16)
+#define _VALUE_SAMPLE(s) _VALUE_S16(s)
+#elif defined(MDC_SAMPLE_FORMAT_FLOAT)
+#define _VALUE_SAMPLE(s) _VALUE_FLOAT(s)
+#endif
+
+#define MDC_CONVBLOCK 256
+
+static const mdc_int_t _sample_size[] = {
+	sizeof(mdc_u8_t),	// MDC_SAMPLE_U8
+	sizeof(mdc_s16_t),	// MDC_SAMPLE_S16
+	sizeof(mdc_u16_t),	// MDC_SAMPLE_U16
+	sizeof(float)		// MDC_SAMPLE_FLOAT
+};
+
+static void _convert(mdc_value_t *values, const void *samples, mdc_int_t n, mdc_sample_format_t format)
+{
+	mdc_int_t i;
+
+	switch(format)
+	{
+	case MDC_SAMPLE_U8:
+		for(i=0; i<n; i++)
+			values[i] = _VALUE_U8(((const mdc_u8_t *)samples)[i]);
+		break;
+	case MDC_SAMPLE_S16:
+		for(i=0; i<n; i++)
+			values[i] = _VALUE_S16(((const mdc_s16_t *)samples)[i]);
+		break;
+	case MDC_SAMPLE_U16:
+		for(i=0; i<n; i++)
+			values[i] = _VALUE_U16(((const mdc_u16_t *)samples)[i]);
+		break;
+	case MDC_SAMPLE_FLOAT:
+		for(i=0; i<n; i++)
+			values[i] = _VALUE_FLOAT(((const float *)samples)[i]);
+		break;
+	}
+}
+
+// unit j's phase wrapped on a sample with level value
+static void _unit_wrapped(mdc_decoder_t *decoder, mdc_int_t j, mdc_value_t value)
+{
+#if defined(MDC_ONEPOINT)
+
+	if(value > 0)
+		decoder->du[j].xorb = 1;
+	else
+		decoder->du[j].xorb = 0;
+	if(decoder->du[j].invert)
+		decoder->du[j].xorb = !(decoder->du[j].xorb);
+	_shiftin(decoder, j);
+
+#elif defined(MDC_FOURPOINT)
+
+	decoder->nlstep[j]++;
+	if(decoder->nlstep[j] > 9)
+		decoder->nlstep[j] = 0;
+	decoder->nlevel[decoder->nlstep[j]][j] = value;
+
+	_nlproc(decoder, j);
+
+	//decoder->du[j].th -= TWOPI;
+
+#endif
+}
+
+static void _process_value(mdc_decoder_t *decoder, mdc_value_t value)
+{
+	mdc_int_t j;
+	mdc_u32_t mask;
+
+	//decoder->du[j].th += (5.0 * decoder->incr);
+	mask = _advance_units(decoder, decoder->config->step);
+	if(mask)
+		decoder->now = decoder->sample;
+	decoder->sample++;
+	while(mask) // units that wrapped, lowest first
+	{
+		j = _lowbit(mask);
+		mask &= mask - 1;
+
+		_unit_wrapped(decoder, j, value);
+	}
+}
+
+/*
+ * event-driven equivalent of calling _process_value for each of n values:
+ * rather than advancing every unit on every sample, work out where each
+ * unit's wraps fall in the block up front, then visit only those samples.
+ * Wraps falling on the same sample are handled lowest unit first, as
+ * _process_value does.
+ */
+typedef struct {
+	mdc_u8_t wraps[MDC_CONVBLOCK];	// bit j set where unit j wraps
+	mdc_u16_t at[MDC_CONVBLOCK];	// samples with any wrap, in order
+	mdc_int_t count;
+} mdc_schedule_t;
+
+// fill in the wrap schedule for the next n samples and advance the units past them
+static void _schedule(mdc_decoder_t *decoder, mdc_schedule_t *sch, mdc_int_t n)
+{
+	mdc_u32_t step = decoder->config->step;
+	mdc_u32_t gap = decoder->config->gap;	// samples from one wrap to the next, less one at most
+	mdc_int_t i, j, count;
+
+	for(i=0; i<n; i++)
+		sch->wraps[i] = 0;
+
+	for(j=0; j<MDC_ND; j++)
+	{
+		mdc_u32_t ph = decoder->thu[j];
+		mdc_u32_t d = (0xffffffff - ph) / step;	// samples before the first wrap
+
+		ph += (d + 1) * step;
+		for(i = d; (mdc_u32_t)i < (mdc_u32_t)n; )
+		{
+			sch->wraps[i] |= 1 << j;
+			// the next wrap is gap samples on, or one more than that
+			if(ph + gap * step < ph)
+			{
+				i += gap;
+				ph += gap * step;
+			}
+			else
+			{
+				i += gap + 1;
+				ph += (gap + 1) * step;
+			}
+		}
+
+		decoder->thu[j] += n * step;
+	}
+
+	count = 0;
+	for(i=0; i<n; i++)
+	{
+		sch->at[count] = i;
+		count += sch->wraps[i] != 0;
+	}
+	sch->count = count;
+}
+
+static void _process_values(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n)
+{
+	mdc_schedule_t sch;
+	mdc_int_t i, j, k;
+	mdc_u32_t mask;
+
+	_schedule(decoder, &sch, n);
+
+	for(k=0; k<sch.count; k++)
+	{
+		i = sch.at[k];
+		decoder->now = decoder->sample + i;
+		mask = sch.wraps[i];
+		while(mask) // units that wrapped, lowest first
+		{
+			j = _lowbit(mask);
+			mask &= mask - 1;
+
+			_unit_wrapped(decoder, j, values[i]);
+		}
+	}
+	decoder->sample += n;
+}
+
+/*
+ * as _process_values, but stop after the sample on which a packet
+ * completes, winding the units back to just after it
+ * returns the number of values used
+ */
+static mdc_int_t _process_values_until(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n)
+{
+	unsigned long decoded = decoder->evdecoded;
+	mdc_schedule_t sch;
+	mdc_int_t i, j, k;
+	mdc_u32_t mask;
+
+	_schedule(decoder, &sch, n);
+
+	for(k=0; k<sch.count; k++)
+	{
+		i = sch.at[k];
+		decoder->now = decoder->sample + i;
+		mask = sch.wraps[i];
+		while(mask)
+		{
+			j = _lowbit(mask);
+			mask &= mask - 1;
+
+			_unit_wrapped(decoder, j, values[i]);
+		}
+
+		if(decoder->evdecoded != decoded)
+		{
+			for(j=0; j<MDC_ND; j++)
+				decoder->thu[j] -= (n - i - 1) * decoder->config->step;
+			n = i + 1;
+			break;
+		}
+	}
+	decoder->sample += n;
+
+	return n;
+}
+
+#ifdef MDC_FOURPOINT
+/*
+ * PLL mode equivalent of _process_values(_until). The units share one
+ * clock, so only unit 0's phase is kept while running: unit j wraps as
+ * that passes (MDC_PLLUNITS - j)/MDC_PLLUNITS of a sample point, and the
+ * units take turns in that order. Each gap between turns is close to its nominal length, so the
+ * count to the next turn is found without a divide
+ */
+static mdc_u32_t _pll_wraps_in(mdc_u64_t room, mdc_u32_t step, mdc_u32_t d)
+{
+	while((mdc_u64_t)d * step > room)
+		d--;
+	while((mdc_u64_t)(d + 1) * step <= room)
+		d++;
+	return d;
+}
+
+static mdc_int_t _process_values_pll(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n, mdc_int_t stop)
+{
+	unsigned long decoded = decoder->evdecoded;
+	mdc_int_t first = MDC_PLLUNITS + 1 - decoder->pll;
+	mdc_int_t i, j, k, x;
+	mdc_u64_t bound[MDC_PLLUNITS + 1], ph, end;
+	mdc_u32_t gap[MDC_PLLUNITS + 1];
+	mdc_u32_t step = decoder->pllstep, next = step, d;
+
+	bound[first - 1] = 0;
+	for(k=first; k<=MDC_PLLUNITS; k++)
+	{
+		bound[k] = ((mdc_u64_t)k << 32) / MDC_PLLUNITS;
+		gap[k] = (bound[k] - bound[k - 1]) / decoder->config->step;
+	}
+
+	ph = decoder->thu[0];
+	for(k=first; bound[k] <= ph; k++)
+		;
+	d = (bound[k] - 1 - ph) / step;
+
+	for(i = 0; d < (mdc_u32_t)(n - i); i = x + 1)
+	{
+		x = i + d;
+		end = ph + (mdc_u64_t)(d + 1) * step;
+		decoder->now = decoder->sample + x;
+		while(end >= bound[k])
+		{
+			j = MDC_PLLUNITS - k;
+			decoder->nlstep[j]++;
+			if(decoder->nlstep[j] > 9)
+				decoder->nlstep[j] = 0;
+			decoder->nlevel[decoder->nlstep[j]][j] = values[x];
+
+			if(_pllproc(decoder, j))
+				next = _pllstep(decoder);
+
+			if(k == MDC_PLLUNITS)
+			{
+				end -= (mdc_u64_t)1 << 32;
+				k = first;
+			}
+			else
+				k++;
+		}
+
+		ph = end;
+		step = decoder->pllstep = next;
+		d = _pll_wraps_in(bound[k] - 1 - ph, step, gap[k]);
+
+		if(stop && decoder->evdecoded != decoded)
+		{
+			i = x + 1;
+			break;
+		}
+	}
+	if(!stop || decoder->evdecoded == decoded)
+	{
+		ph += (mdc_u64_t)(n - i) * step;
+		i = n;
+	}
+
+	for(j=0; j<decoder->pll; j++)
+		decoder->thu[j] = (mdc_u32_t)ph - (mdc_u32_t)bound[MDC_PLLUNITS - j];
+	decoder->sample += i;
+
+	return i;
+}
+
+// PLL units start a third of a bit (5/3 of a sample point) apart, on the nominal step
+static void _pll_init(mdc_decoder_t *decoder)
+{
+	mdc_int_t j, k;
+
+	for(j=0; j<MDC_ND; j++)
+	{
+		for(k=0; k<10; k++)
+			decoder->nlevel[k][j] = 0;
+		decoder->thu[j] = j * 2 * (0x80000000 / MDC_ND);
+		decoder->nlstep[j] = j;
+		decoder->du[j].shstate = -1;
+		decoder->du[j].invert = 0;
+		decoder->du[j].xorb = 0;
+		if(decoder->pll && j < MDC_PLLUNITS)
+		{
+			decoder->thu[j] = -(mdc_u32_t)(((mdc_u64_t)(MDC_PLLUNITS - j) << 32) / MDC_PLLUNITS);
+			decoder->nlstep[j] = j ? 9 - j * 5 / MDC_PLLUNITS : 0;
+		}
+	}
+	for(j=0; j<MDC_PLLUNITS; j++)
+		decoder->pllerr[j] = 0;
+	decoder->pllstep = decoder->config->step;
+	decoder->indouble = 0;
+}
+#endif
+
+/*
+ * idle gate: a block whose mean absolute level is under gate_level (in
+ * 16-bit sample units) is skipped, once the level has stayed low for
+ * MDC_GATEHANG blocks. Decode units are advanced past a skipped block
+ * exactly as if it had been processed, so their phases are unchanged
+ * when signal returns and a preamble is picked up as before.
+ */
+static mdc_int_t _gate_idle(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n)
+{
+	mdc_value_t sum = 0;
+	mdc_int_t i;
+
+	for(i=0; i<n; i++)
+		sum += values[i] < 0 ? -values[i] : values[i];
+
+	decoder->gate_blocks++;
+
+	if(sum >= _VALUE_S16(decoder->gate_level) * n)
+	{
+		decoder->gate_hang = MDC_GATEHANG;
+		decoder->gate_idle = 0;
+		return 0;
+	}
+
+	if(decoder->gate_hang > 0)
+	{
+		decoder->gate_hang--;
+		return 0;
+	}
+
+	decoder->gate_skipped++;
+	return 1;
+}
+
+static void _skip_values(mdc_decoder_t *decoder, mdc_int_t n)
+{
+	mdc_u32_t step = decoder->config->step;
+	mdc_int_t j;
+
+	for(j=0; j<MDC_ND; j++)
+	{
+#ifdef MDC_FOURPOINT
+		mdc_u64_t wraps;
+
+		if(decoder->pll)
+		{
+			if(j >= decoder->pll)
+				break;
+			step = decoder->pllstep;
+		}
+		wraps = ((mdc_u64_t)decoder->thu[j] + (mdc_u64_t)n * step) >> 32;
+		decoder->nlstep[j] = (decoder->nlstep[j] + wraps) % 10;
+#endif
+		decoder->thu[j] += n * step;
+	}
+	decoder->sample += n;
+
+	if(!decoder->gate_idle)
+	{
+		// signal has gone: drop any frame in progress and the level history
+		decoder->gate_idle = 1;
+		for(j=0; j<MDC_ND; j++)
+		{
+			if(decoder->du[j].shstate > 0)
+				decoder->du[j].shstate = -1;
+#ifdef MDC_FOURPOINT
+			{
+				mdc_int_t k;
+				for(k=0; k<10; k++)
+					decoder->nlevel[k][j] = 0;
+			}
+#endif
+		}
+	}
+}
+
+static void _process_block(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n)
+{
+	mdc_int_t i;
+
+#ifdef MDC_FOURPOINT
+	if(decoder->pll)
+	{
+		_process_values_pll(decoder, values, n, 0);
+		return;
+	}
+#endif
+
+	if(decoder->config->eventdriven)
+		_process_values(decoder, values, n);
+	else
+	{
+		for(i = 0; i<n; i++)
+			_process_value(decoder, values[i]);
+	}
+}
+
+// returns the number of values used
+static mdc_int_t _process_block_until(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n)
+{
+	unsigned long decoded = decoder->evdecoded;
+	mdc_int_t i;
+
+#ifdef MDC_FOURPOINT
+	if(decoder->pll)
+		return _process_values_pll(decoder, values, n, 1);
+#endif
+
+	if(decoder->config->eventdriven)
+		return _process_values_until(decoder, values, n);
+
+	for(i = 0; i<n; i++)
+	{
+		_process_value(decoder, values[i]);
+		if(decoder->evdecoded != decoded)
+			return i + 1;
+	}
+
+	return n;
+}
+
+/*
+ * a block of converted values through the idle gate, if set, and on to the
+ * decode units; if until is set, stop after the value on which a packet
+ * completes. Returns the number of values used
+ */
+static mdc_int_t _process_gated(mdc_decoder_t *decoder, const mdc_value_t *values, mdc_int_t n, mdc_int_t until)
+{
+	mdc_int_t i, m, r;
+
+	if(!decoder->gate_level)
+	{
+		if(until)
+			return _process_block_until(decoder, values, n);
+		_process_block(decoder, values, n);
+		return n;
+	}
+
+	for(i = 0; i<n; i += MDC_GATEBLOCK)
+	{
+		m = n - i < MDC_GATEBLOCK ? n - i : MDC_GATEBLOCK;
+
+		if(_gate_idle(decoder, values + i, m))
+			_skip_values(decoder, m);
+		else if(!until)
+			_process_block(decoder, values + i, m);
+		else if((r = _process_block_until(decoder, values + i, m)) < m)
+			return i + r;
+	}
+
+	return n;
+}
+
+/*
+ * if consumed is set, stop after the sample on which a packet completes
+ * and store the number of samples used there
+ */
+static int _process_samples(mdc_decoder_t *decoder,
+                            const void *samples,
+                            int numSamples,
+                            mdc_sample_format_t format,
+                            int *consumed)
+{
+	mdc_value_t values[MDC_CONVBLOCK];
+	mdc_int_t n, used;
+	int total = 0;
+
+	if(!decoder)
+		return -1;
+
+	while(numSamples > 0)
+	{
+		n = numSamples < MDC_CONVBLOCK ? numSamples : MDC_CONVBLOCK;
+
+		_convert(values, samples, n, format);
+		used = _process_gated(decoder, values, n, consumed != 0L);
+
+		total += used;
+		if(used < n)
+			break;
+
+		samples = (const mdc_u8_t *)samples + n * _sample_size[format];
+		numSamples -= n;
+	}
+
+	if(consumed)
+		*consumed = total;
+
+	return _pending(decoder);
+}
+
+int mdc_decoder_process_samples(mdc_decoder_t *decoder,
+                                mdc_sample_t *samples,
+                                int numSamples)
+{
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_FORMAT, 0L);
+}
+
+int mdc_decoder_process_samples_until(mdc_decoder_t *decoder,
+                                      mdc_sample_t *samples,
+                                      int numSamples,
+                                      int *consumed)
+{
+	int unused;
+
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_FORMAT, consumed ? consumed : &unused);
+}
+
+int mdc_decoder_process_samples_u8(mdc_decoder_t *decoder,
+                                   const unsigned char *samples,
+                                   int numSamples)
+{
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_U8, 0L);
+}
+
+int mdc_decoder_process_samples_s16(mdc_decoder_t *decoder,
+                                    const short *samples,
+                                    int numSamples)
+{
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_S16, 0L);
+}
+
+int mdc_decoder_process_samples_u16(mdc_decoder_t *decoder,
+                                    const unsigned short *samples,
+                                    int numSamples)
+{
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_U16, 0L);
+}
+
+int mdc_decoder_process_samples_float(mdc_decoder_t *decoder,
+                                      const float *samples,
+                                      int numSamples)
+{
+	return _process_samples(decoder, samples, numSamples, MDC_SAMPLE_FLOAT, 0L);
+}
+
+int mdc_decoder_get_packet(mdc_decoder_t *decoder, 
+                           unsigned char *op,
 			   unsigned char *arg,
 			   unsigned short *unitID)
 {
+	mdc_decoder_event_t *ev;
+
 	if(!decoder)
 		return -1;
 
-	if(decoder->good != 1)
+	if(_pending(decoder) != 1)
 		return -1;
 
+	ev = &decoder->events[decoder->evtail++ % MDC_EVENTQ];
+
 	if(op)
-		*op = decoder->op;
+		*op = ev->op;
 
 	if(arg)
-		*arg = decoder->arg;
+		*arg = ev->arg;
 
 	if(unitID)
-		*unitID = decoder->unitID;
-
-	decoder->good = 0;
+		*unitID = ev->unitID;
 
 	return 0;
 }
@@ -504,31 +1371,92 @@ int mdc_decoder_get_double_packet(mdc_decoder_t *decoder,
                            unsigned char *extra2,
                            unsigned char *extra3)
 {
+	mdc_decoder_event_t *ev;
+
 	if(!decoder)
 		return -1;
 
-	if(decoder->good != 2)
+	if(_pending(decoder) != 2)
 		return -1;
 
+	ev = &decoder->events[decoder->evtail++ % MDC_EVENTQ];
+
 	if(op)
-		*op = decoder->op;
+		*op = ev->op;
 
 	if(arg)
-		*arg = decoder->arg;
+		*arg = ev->arg;
 
 	if(unitID)
-		*unitID = decoder->unitID;
+		*unitID = ev->unitID;
 
 	if(extra0)
-		*extra0 = decoder->extra0;
+		*extra0 = ev->extra0;
 	if(extra1)
-		*extra1 = decoder->extra1;
+		*extra1 = ev->extra1;
 	if(extra2)
-		*extra2 = decoder->extra2;
+		*extra2 = ev->extra2;
 	if(extra3)
-		*extra3 = decoder->extra3;
+		*extra3 = ev->extra3;
+
+	return 0;
+}
+
+int mdc_decoder_set_event_callback(mdc_decoder_t *decoder, mdc_decoder_event_callback_t callbackFunction, void *context)
+{
+	if(!decoder)
+		return -1;
+
+	decoder->event_callback = callbackFunction;
+	decoder->event_callback_context = context;
+
+	return 0;
+}
+
+int mdc_decoder_set_timestamp(mdc_decoder_t *decoder, mdc_u64_t timestamp, mdc_u64_t ticksPerSecond)
+{
+	if(!decoder)
+		return -1;
+
+	decoder->tsbase = timestamp;
+	decoder->tssample = decoder->sample;
+	decoder->tsrate = ticksPerSecond;
+
+	return 0;
+}
+
+mdc_u64_t mdc_decoder_get_sample_count(mdc_decoder_t *decoder)
+{
+	if(!decoder)
+		return 0;
+
+	return decoder->sample;
+}
+
+int mdc_decoder_get_events(mdc_decoder_t *decoder,
+                           mdc_decoder_event_t *events,
+                           int maxEvents)
+{
+	int n;
+
+	if(!decoder || maxEvents < 0 || (maxEvents && !events))
+		return -1;
+
+	for(n = 0; n<maxEvents && decoder->evtail != decoder->evhead; n++)
+		events[n] = decoder->events[decoder->evtail++ % MDC_EVENTQ];
+
+	return n;
+}
+
+int mdc_decoder_get_event_stats(mdc_decoder_t *decoder, unsigned long *decoded, unsigned long *dropped)
+{
+	if(!decoder)
+		return -1;
 
-	decoder->good = 0;
+	if(decoded)
+		*decoded = decoder->evdecoded;
+	if(dropped)
+		*dropped = decoder->evdropped;
 
 	return 0;
 }
@@ -543,3 +1471,184 @@ int mdc_decoder_set_callback(mdc_decoder_t *decoder, mdc_decoder_callback_t call
 
 	return 0;
 }
+
+mdc_multi_decoder_t * mdc_multi_decoder_new(int sampleRate, int numChannels)
+{
+	mdc_multi_decoder_t *decoder;
+	mdc_int_t i;
+
+	if(numChannels < 1)
+		return (mdc_multi_decoder_t *) 0L;
+
+	decoder = (mdc_multi_decoder_t *)malloc(sizeof(mdc_multi_decoder_t));
+	if(!decoder)
+		return (mdc_multi_decoder_t *) 0L;
+
+	decoder->decoders = (mdc_decoder_t *)malloc(numChannels * sizeof(mdc_decoder_t));
+	if(!decoder->decoders)
+	{
+		free(decoder);
+		return (mdc_multi_decoder_t *) 0L;
+	}
+
+	for(i=0; i<numChannels; i++)
+	{
+		if(_decoder_init_rate(&(decoder->decoders[i]), sampleRate))
+		{
+			free(decoder->decoders);
+			free(decoder);
+			return (mdc_multi_decoder_t *) 0L;
+		}
+		decoder->decoders[i].allocated = 0;	// owned by the multi decoder
+		decoder->decoders[i].channel = i;
+	}
+
+	decoder->numChannels = numChannels;
+	decoder->curChannel = 0;
+	decoder->callback = (mdc_multi_decoder_callback_t)0L;
+	decoder->callback_context = (void *)0L;
+
+	return decoder;
+}
+
+void mdc_multi_decoder_destroy(mdc_multi_decoder_t *decoder)
+{
+	if(!decoder)
+		return;
+
+	free(decoder->decoders);
+	free(decoder);
+}
+
+static void _multi_callback(int frameCount, unsigned char op, unsigned char arg, unsigned short unitID,
+                            unsigned char extra0, unsigned char extra1, unsigned char extra2, unsigned char extra3,
+                            void *context)
+{
+	mdc_multi_decoder_t *decoder = (mdc_multi_decoder_t *)context;
+
+	(decoder->callback)(decoder->curChannel, frameCount, op, arg, unitID,
+	                    extra0, extra1, extra2, extra3, decoder->callback_context);
+}
+
+int mdc_multi_decoder_process_interleaved(mdc_multi_decoder_t *decoder,
+                                          mdc_sample_t *samples,
+                                          int numFrames,
+                                          int channels,
+                                          int stride)
+{
+	mdc_value_t values[MDC_CONVBLOCK];
+	mdc_int_t i, c, n;
+	mdc_int_t count;
+
+	if(!decoder)
+		return -1;
+
+	if(channels < 1 || channels > decoder->numChannels || stride < channels)
+		return -1;
+
+	// a block of frames at a time, each channel's samples gathered into a
+	// block of its own, so every channel decodes as a single decoder would
+	// (idle gate, PLL and wrap scheduling included)
+	while(numFrames > 0)
+	{
+		n = numFrames < MDC_CONVBLOCK ? numFrames : MDC_CONVBLOCK;
+
+		for(c = 0; c<channels; c++)
+		{
+			for(i = 0; i<n; i++)
+				values[i] = _VALUE_SAMPLE(samples[i * stride + c]);
+			decoder->curChannel = c;
+			_process_gated(&decoder->decoders[c], values, n, 0);
+		}
+
+		samples += n * stride;
+		numFrames -= n;
+	}
+
+	count = 0;
+	for(c = 0; c<channels; c++)
+	{
+		if(_pending(&decoder->decoders[c]))
+			++count;
+	}
+
+	return count;
+}
+
+mdc_decoder_t * mdc_multi_decoder_get_channel(mdc_multi_decoder_t *decoder, int channel)
+{
+	if(!decoder)
+		return (mdc_decoder_t *) 0L;
+
+	if(channel < 0 || channel >= decoder->numChannels)
+		return (mdc_decoder_t *) 0L;
+
+	return &(decoder->decoders[channel]);
+}
+
+int mdc_multi_decoder_set_callback(mdc_multi_decoder_t *decoder, mdc_multi_decoder_callback_t callbackFunction, void *context)
+{
+	mdc_int_t i;
+
+	if(!decoder)
+		return -1;
+
+	decoder->callback = callbackFunction;
+	decoder->callback_context = context;
+
+	for(i=0; i<decoder->numChannels; i++)
+	{
+		if(callbackFunction)
+			mdc_decoder_set_callback(&(decoder->decoders[i]), _multi_callback, (void *)decoder);
+		else
+			mdc_decoder_set_callback(&(decoder->decoders[i]), (mdc_decoder_callback_t)0L, (void *)0L);
+	}
+
+	return 0;
+}
+
+int mdc_decoder_set_gate(mdc_decoder_t *decoder, int level)
+{
+	if(!decoder)
+		return -1;
+
+	if(level < 0 || level > 32767)
+		return -1;
+
+	decoder->gate_level = level;
+	decoder->gate_hang = MDC_GATEHANG;
+	decoder->gate_idle = 0;
+
+	return 0;
+}
+
+int mdc_decoder_set_pll(mdc_decoder_t *decoder, int units)
+{
+	if(!decoder)
+		return -1;
+
+#ifdef MDC_FOURPOINT
+	if(units < 0 || units > MDC_PLLUNITS)
+		return -1;
+
+	decoder->pll = units;
+	_pll_init(decoder);
+
+	return 0;
+#else
+	return units ? -1 : 0;
+#endif
+}
+
+int mdc_decoder_get_gate_stats(mdc_decoder_t *decoder, unsigned long *blocks, unsigned long *skipped)
+{
+	if(!decoder)
+		return -1;
+
+	if(blocks)
+		*blocks = decoder->gate_blocks;
+	if(skipped)
+		*skipped = decoder->gate_skipped;
+
+	return 0;
+}
@@ -53,6 +53,25 @@
  #define MDC_ND 4  // recommended for one-point method
 #endif
 
+#if defined(__SSE2__) && !defined(MDC_NO_SIMD)
+ #define MDC_SIMD	// advance all decode unit phases at once with SSE2/AVX2
+#endif
+
+#define MDC_NDV 8	// MDC_ND rounded up to a whole number of SIMD vectors
+
+#define MDC_PLLUNITS 3	// most decode units in PLL mode
+
+#define MDC_GATEBLOCK 64	// samples per idle gate decision
+#define MDC_GATEHANG 16	// quiet blocks before the idle gate closes
+
+#ifndef MDC_EVENTQ
+ #define MDC_EVENTQ 8	// decoded packets held per decoder, must be a power of 2
+#endif
+
+#ifndef MDC_EVENTGAP
+ #define MDC_EVENTGAP 4	// samples between unit phase wraps at which to switch to event-driven decoding
+#endif
+
 typedef void (*mdc_decoder_callback_t)(	int frameCount, // 1 or 2 - if 2 then extra0-3 are valid
 										unsigned char op,
 										unsigned char arg,
@@ -63,43 +82,85 @@ typedef void (*mdc_decoder_callback_t)(	int frameCount, // 1 or 2 - if 2 then ex
 										unsigned char extra3,
 										void *context);
 
+typedef struct
+{
+	mdc_u8_t frameCount;	// 1 or 2 - if 2 then extra0-3 are valid
+	mdc_u8_t op;
+	mdc_u8_t arg;
+	mdc_u16_t unitID;
+	mdc_u8_t extra0;
+	mdc_u8_t extra1;
+	mdc_u8_t extra2;
+	mdc_u8_t extra3;
+	mdc_int_t channel;	// channel number within a multi-decoder, 0 otherwise
+	mdc_u64_t syncSample;	// stream position of the sample completing (first) frame sync
+	mdc_u64_t endSample;	// stream position of the sample completing the packet
+	mdc_u64_t syncTime;	// the same, as caller timestamps (0 if none set)
+	mdc_u64_t endTime;
+} mdc_decoder_event_t;
+
+typedef void (*mdc_decoder_event_callback_t)(const mdc_decoder_event_t *event, void *context);
+
+/*
+ * settings fixed when a decoder is created; read-only afterwards, so one
+ * copy can be shared by any number of decoders at the same sampling rate
+ */
+typedef struct {
+	mdc_int_t sampleRate;
+	mdc_u32_t incru;	// 1200 Hz phase increment per sample
+	mdc_u32_t step;	// decode unit phase increment per sample
+	mdc_u32_t gap;	// samples from one unit phase wrap to the next, less one at most
+	mdc_u8_t syncThreshold;	// sync bit errors tolerated, MDC_GDTHRESH
+	mdc_u8_t eventdriven;	// skip from wrap to wrap rather than visit every sample
+} mdc_decoder_config_t;
+
 typedef struct
 {
 //	mdc_float_t th;
-	mdc_u32_t thu;
+//	mdc_u32_t thu; - moved to mdc_decoder_t
 //	mdc_int_t zc; - deprecated
-	mdc_int_t xorb;
-	mdc_int_t invert;
+	mdc_u64_t sync;	// last 40 bits received, newest in bit 0
+	mdc_u64_t bits[2];	// received frame, already de-interleaved, packed LSB-first
+	mdc_u64_t syncat;	// stream position where sync was found
+	mdc_u8_t xorb;
+	mdc_u8_t invert;
+	mdc_s8_t shstate;
+	mdc_u8_t shcount;
+} mdc_decode_unit_t;
+
+/*
+ * per-channel decoder state. Everything touched while samples are being
+ * decoded comes first: for the four-point decoder at MDC_ND 5 that is
+ * under 512 bytes (8 cache lines) with floating point, or with
+ * MDC_FIXEDMATH. Packet queue, statistics and callbacks follow, touched
+ * only when a packet completes or the caller asks; the whole object is
+ * 1 KB on 64-bit targets with the default MDC_EVENTQ of 8
+ */
+typedef struct {
+	// per-unit phase state, kept as arrays across units so all units advance together
+	mdc_u32_t thu[MDC_NDV];
+	const mdc_decoder_config_t *config;
 #ifdef MDC_FOURPOINT
 #ifdef MDC_FIXEDMATH
-#error "fixed-point math not allowed for fourpoint strategy"
+	mdc_int_t nlevel[10][MDC_ND];	// raw 16-bit sample levels
+#else
+	float nlevel[10][MDC_ND];	// float holds every converted input level exactly
 #endif // MDC_FIXEDMATH
-	mdc_int_t nlstep;
-	mdc_float_t nlevel[10];
+	mdc_u8_t nlstep[MDC_ND];
+	mdc_u8_t pll;	// decode units in PLL mode, 0 for the fixed-phase units
+	mdc_u32_t pllstep;	// PLL units' shared phase increment, config->step plus every pllerr
+	mdc_s32 pllerr[MDC_PLLUNITS];	// each PLL unit's last early-late correction to it
 #endif  // MDC_FOURPOINT
-#ifdef PLL
-	mdc_u32_t plt;
-#endif
-	mdc_u32_t synclow;
-	mdc_u32_t synchigh;
-	mdc_int_t shstate;
-	mdc_int_t shcount;
-	mdc_int_t bits[112];
-} mdc_decode_unit_t;
-
-typedef struct {
+	mdc_u8_t indouble;
 	mdc_decode_unit_t du[MDC_ND];
 //	mdc_float_t hyst;
 //	mdc_float_t incr;
-	mdc_u32_t incru;
-#ifdef PLL
-	mdc_u32_t zthu;
-	mdc_int_t zprev;
-	mdc_float_t vprev;
-#endif
-	mdc_int_t level;
-	mdc_int_t good;
-	mdc_int_t indouble;
+	mdc_u64_t sample;	// stream position of the next sample, from 0
+	mdc_u64_t now;	// stream position of the sample being decoded
+	mdc_u64_t syncat;	// sync position of the packet being completed
+	mdc_int_t gate_level;	// idle gate threshold, 0 if off
+	mdc_int_t gate_hang;
+	mdc_int_t gate_idle;
 	mdc_u8_t op;
 	mdc_u8_t arg;
 	mdc_u16_t unitID;
@@ -107,8 +168,23 @@ typedef struct {
 	mdc_u8_t extra1;
 	mdc_u8_t extra2;
 	mdc_u8_t extra3;
+	mdc_int_t channel;
+	mdc_u32_t evhead;
+	mdc_u32_t evtail;
+	mdc_decoder_event_t events[MDC_EVENTQ];	// decoded packets not yet read, oldest at evtail
+	mdc_u64_t tsbase;	// caller timestamp of stream position tssample
+	mdc_u64_t tssample;
+	mdc_u64_t tsrate;	// caller timestamp ticks per second, 0 if none set
+	unsigned long evdecoded;
+	unsigned long evdropped;
+	unsigned long gate_blocks;
+	unsigned long gate_skipped;
 	mdc_decoder_callback_t callback;
 	void *callback_context;
+	mdc_decoder_event_callback_t event_callback;
+	void *event_callback_context;
+	mdc_decoder_config_t ownconfig;	// used when no shared config applies
+	mdc_int_t allocated;	// set if created by mdc_decoder_new
 } mdc_decoder_t;
 	
 
@@ -124,6 +200,77 @@ typedef struct {
 */
 mdc_decoder_t * mdc_decoder_new(int sampleRate);
 
+/*
+ mdc_decoder_config_init
+ fill in a decoder config for a sampling rate, to share between decoders
+ created with mdc_decoder_init_config
+
+  parameters: mdc_decoder_config_t *config - pointer to the config to fill in
+              int sampleRate - the sampling rate in Hz, above 1200 Hz (6000 Hz
+                               for the four-point decoder)
+
+  returns: -1 if error (including an unusable sampling rate), 0 otherwise
+*/
+int mdc_decoder_config_init(mdc_decoder_config_t *config, int sampleRate);
+
+/*
+ mdc_decoder_init_config
+ as mdc_decoder_init, but using a config set up by mdc_decoder_config_init,
+ which must not change and must remain valid for as long as the decoder is used.
+ (mdc_decoder_new and mdc_decoder_init share built-in configs among decoders
+ at the same standard sampling rate without this)
+
+  parameters: void *mem - at least mdc_decoder_sizeof() bytes, aligned to mdc_decoder_alignof()
+              const mdc_decoder_config_t *config - pointer to the config
+
+  returns: an mdc_decoder object (at mem) or null if failure
+*/
+mdc_decoder_t * mdc_decoder_init_config(void *mem, const mdc_decoder_config_t *config);
+
+/*
+ mdc_decoder_sizeof, mdc_decoder_alignof
+ size and alignment, in bytes, of the memory needed by mdc_decoder_init
+
+  returns: size or alignment
+*/
+int mdc_decoder_sizeof(void);
+int mdc_decoder_alignof(void);
+
+/*
+ mdc_decoder_init
+ create an mdc_decoder object in memory supplied by the caller, which must
+ remain valid for as long as the object is used
+
+  parameters: void *mem - at least mdc_decoder_sizeof() bytes, aligned to mdc_decoder_alignof()
+              int sampleRate - the sampling rate in Hz
+
+  returns: an mdc_decoder object (at mem) or null if failure
+
+*/
+mdc_decoder_t * mdc_decoder_init(void *mem, int sampleRate);
+
+/*
+ mdc_decoder_reset
+ return a decoder object to its state when first created, at the same sampling
+ rate, ready for a new stream. Unread packets, callbacks, gate and timestamp
+ settings and counters are all cleared; a multi-decoder or engine channel keeps
+ its channel number
+
+  parameters: mdc_decoder_t *decoder - pointer to the decoder object
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_decoder_reset(mdc_decoder_t *decoder);
+
+/*
+ mdc_decoder_destroy
+ dispose of a decoder object, freeing it if it was made by mdc_decoder_new
+ (memory given to mdc_decoder_init stays with the caller)
+
+  parameters: mdc_decoder_t *decoder - pointer to the decoder object
+*/
+void mdc_decoder_destroy(mdc_decoder_t *decoder);
+
 /*
  mdc_decoder_process_samples
  process incoming samples using an mdc_decoder object
@@ -136,12 +283,62 @@ mdc_decoder_t * mdc_decoder_new(int sampleRate);
          -1 if an error occurs
           1 if a decoded single packet is available to read (if no callback set)
           2 if a decoded double packet is available to read (if no callback set)
+
+ without a callback, up to MDC_EVENTQ decoded packets are held until read; the
+ return value describes the oldest. If the queue is full, the oldest packet is
+ dropped to make room and counted (see mdc_decoder_get_event_stats)
 */
  
 int mdc_decoder_process_samples(mdc_decoder_t *decoder,
                                 mdc_sample_t *samples,
                                 int numSamples);
 
+/*
+ mdc_decoder_process_samples_until
+ as mdc_decoder_process_samples, but return as soon as a packet has been
+ decoded (queued, or passed to a callback) rather than processing the whole
+ buffer. Samples after that point have not been looked at; pass them in
+ again, from samples + *consumed, to carry on.
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             mdc_sample_t *samples - pointer to samples (in format set in mdc_types.h)
+             int numSamples - count of the number of samples in buffer
+             int *consumed - pointer to where to store the number of samples used
+
+ returns: as mdc_decoder_process_samples
+*/
+
+int mdc_decoder_process_samples_until(mdc_decoder_t *decoder,
+                                      mdc_sample_t *samples,
+                                      int numSamples,
+                                      int *consumed);
+
+/*
+ mdc_decoder_process_samples_u8, _s16, _u16, _float
+ as mdc_decoder_process_samples, but for samples in the named format
+ regardless of the format set in mdc_types.h:
+   u8    - unsigned 8-bit, 128 is zero level
+   s16   - signed 16-bit
+   u16   - unsigned 16-bit, 32768 is zero level
+   float - -1.0 to 1.0
+*/
+
+int mdc_decoder_process_samples_u8(mdc_decoder_t *decoder,
+                                   const unsigned char *samples,
+                                   int numSamples);
+
+int mdc_decoder_process_samples_s16(mdc_decoder_t *decoder,
+                                    const short *samples,
+                                    int numSamples);
+
+int mdc_decoder_process_samples_u16(mdc_decoder_t *decoder,
+                                    const unsigned short *samples,
+                                    int numSamples);
+
+int mdc_decoder_process_samples_float(mdc_decoder_t *decoder,
+                                      const float *samples,
+                                      int numSamples);
+
 
 /*
  mdc_decoder_get_packet
@@ -186,6 +383,79 @@ int mdc_decoder_get_double_packet(mdc_decoder_t *decoder,
                            unsigned char *extra3);
 
 
+/*
+ mdc_decoder_set_event_callback
+ set a callback function to be called upon successful decode, receiving the
+ full packet record including stream positions and timestamps
+ if this is set, neither the mdc_decoder_set_callback function nor the
+ packet queue is used
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             mdc_decoder_event_callback_t callbackFunction - pointer to the callback function
+             void *context - context to pass to the callback function
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_set_event_callback(mdc_decoder_t *decoder, mdc_decoder_event_callback_t callbackFunction, void *context);
+
+/*
+ mdc_decoder_set_timestamp
+ give the caller's timestamp for the next sample to be processed; syncTime and
+ endTime of later packets are derived from it by sample count, counting back
+ from it for a packet that synced before it was given. May be called before
+ every block
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             mdc_u64_t timestamp - timestamp of the next sample
+             mdc_u64_t ticksPerSecond - timestamp units per second, 0 to stop timestamping
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_set_timestamp(mdc_decoder_t *decoder, mdc_u64_t timestamp, mdc_u64_t ticksPerSecond);
+
+/*
+ mdc_decoder_get_sample_count
+ number of samples processed since the decoder object was created; this is the
+ stream position of the next sample, as used in mdc_decoder_event_t
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+
+ returns: sample count, 0 if error
+*/
+
+mdc_u64_t mdc_decoder_get_sample_count(mdc_decoder_t *decoder);
+
+/*
+ mdc_decoder_get_events
+ retrieve decoded packets, oldest first, removing them from the decoder object
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             mdc_decoder_event_t *events - array to store packets in
+             int maxEvents - size of the events array
+
+ returns: -1 if error, otherwise the number of packets stored
+*/
+
+int mdc_decoder_get_events(mdc_decoder_t *decoder,
+                           mdc_decoder_event_t *events,
+                           int maxEvents);
+
+/*
+ mdc_decoder_get_event_stats
+ retrieve decoded packet counters
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             unsigned long *decoded - pointer to where to store the number of packets decoded
+             unsigned long *dropped - pointer to where to store the number of packets
+                                      dropped unread because the queue was full
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_get_event_stats(mdc_decoder_t *decoder, unsigned long *decoded, unsigned long *dropped);
+
 /*
  mdc_decoder_set_callback
  set a callback function to be called upon successful decode
@@ -200,4 +470,144 @@ int mdc_decoder_get_double_packet(mdc_decoder_t *decoder,
 
 int mdc_decoder_set_callback(mdc_decoder_t *decoder, mdc_decoder_callback_t callbackFunction, void *context);
 
+
+/*
+ mdc_decoder_set_gate
+ turn on an idle gate, for channels that are mostly silent or carry only voice
+ input is examined in blocks of MDC_GATEBLOCK samples; once the mean absolute level
+ has stayed under the threshold for MDC_GATEHANG blocks, the decode units are
+ stepped over each quiet block instead of running on it, until a block at or
+ above the threshold arrives
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             int level - mean absolute level, in 16-bit sample units (0 - 32767),
+                         below which input is treated as idle; 0 turns the gate off.
+                         Full scale in any input format (u8, u16 or float) counts
+                         as 32767
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_set_gate(mdc_decoder_t *decoder, int level);
+
+/*
+ mdc_decoder_set_pll
+ choose between the MDC_ND decode units at fixed bit phases and one to
+ MDC_PLLUNITS units that recover the bit clock instead. The units sit a
+ third of a bit apart on one shared clock, which each steers by comparing
+ its four-point decision a fifth of a bit early and late. The preamble is
+ a steady 1800 Hz tone, so the clock can only lock to within a third of a
+ bit before data starts: one unit does a fifth of the fixed units' work
+ but misses packets where it settles on the wrong third, three cover all
+ of them and ride out a drifting sender clock far better. Four-point
+ builds only; switching drops any packet in progress
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             int units - 1 to MDC_PLLUNITS for PLL mode, 0 for the fixed units
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_set_pll(mdc_decoder_t *decoder, int units);
+
+/*
+ mdc_decoder_get_gate_stats
+ retrieve idle gate counters
+
+ parameters: mdc_decoder_t *decoder - pointer to the decoder object
+             unsigned long *blocks  - pointer to where to store the number of blocks examined
+             unsigned long *skipped - pointer to where to store the number of blocks skipped
+
+ returns: -1 if error, 0 otherwise
+*/
+
+int mdc_decoder_get_gate_stats(mdc_decoder_t *decoder, unsigned long *blocks, unsigned long *skipped);
+
+typedef void (*mdc_multi_decoder_callback_t)(	int channel, // index of the channel the packet was found on
+												int frameCount, // 1 or 2 - if 2 then extra0-3 are valid
+												unsigned char op,
+												unsigned char arg,
+												unsigned short unitID,
+												unsigned char extra0,
+												unsigned char extra1,
+												unsigned char extra2,
+												unsigned char extra3,
+												void *context);
+
+typedef struct {
+	mdc_int_t numChannels;
+	mdc_int_t curChannel;
+	mdc_multi_decoder_callback_t callback;
+	void *callback_context;
+	mdc_decoder_t *decoders;	// numChannels decoders, allocated contiguously
+} mdc_multi_decoder_t;
+
+
+/*
+ mdc_multi_decoder_new
+ create a new mdc_multi_decoder object, holding one decoder per channel
+
+  parameters: int sampleRate - the sampling rate in Hz
+              int numChannels - the number of channels to decode
+
+  returns: an mdc_multi_decoder object or null if failure
+
+*/
+mdc_multi_decoder_t * mdc_multi_decoder_new(int sampleRate, int numChannels);
+
+/*
+ mdc_multi_decoder_destroy
+ free a multi decoder object and the decoders for all of its channels
+
+  parameters: mdc_multi_decoder_t *decoder - pointer to the multi decoder object
+*/
+void mdc_multi_decoder_destroy(mdc_multi_decoder_t *decoder);
+
+/*
+ mdc_multi_decoder_process_interleaved
+ process a buffer of frame-interleaved samples, channel 0 first in each frame.
+ Each channel decodes exactly as a single decoder given its samples would,
+ including any idle gate or PLL set on it through mdc_multi_decoder_get_channel
+
+ parameters: mdc_multi_decoder_t *decoder - pointer to the multi decoder object
+             mdc_sample_t *samples - pointer to samples (in format set in mdc_types.h)
+             int numFrames - count of the number of frames in buffer
+             int channels - number of channels to decode from each frame (at most numChannels)
+             int stride - distance in samples from one frame to the next (at least channels)
+
+ returns: -1 if an error occurs
+          otherwise the number of channels holding a decoded packet to read (0 if callback set)
+          use mdc_multi_decoder_get_channel() with mdc_decoder_get_packet() or
+          mdc_decoder_get_double_packet() to read them
+*/
+
+int mdc_multi_decoder_process_interleaved(mdc_multi_decoder_t *decoder,
+                                          mdc_sample_t *samples,
+                                          int numFrames,
+                                          int channels,
+                                          int stride);
+
+/*
+ mdc_multi_decoder_get_channel
+ retrieve the decoder object for a single channel of a multi decoder
+
+ parameters: mdc_multi_decoder_t *decoder - pointer to the multi decoder object
+             int channel - the channel index
+
+ returns: the channel's mdc_decoder object or null if failure
+*/
+
+mdc_decoder_t * mdc_multi_decoder_get_channel(mdc_multi_decoder_t *decoder, int channel);
+
+/*
+ mdc_multi_decoder_set_callback
+ set a callback function to be called upon successful decode on any channel
+ the callback is passed the index of the channel the packet was decoded on and
+ the (void *)context that is set here, as with mdc_decoder_set_callback
+
+ returns: -1 if error, 0 otherwise
+ */
+
+int mdc_multi_decoder_set_callback(mdc_multi_decoder_t *decoder, mdc_multi_decoder_callback_t callbackFunction, void *context);
+
 #endif
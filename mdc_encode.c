@@ -36,14 +36,29 @@
 -*/
 
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 #include "mdc_encode.h"
 #include "mdc_common.c"
 
-#if defined(MDC_SAMPLE_FORMAT_U8)
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(MDC_NO_SIMD)
+ #define MDC_SIMD	// render tone runs 8 samples at a time with AVX2, if the CPU has it
+#include <immintrin.h>
+#endif
+
+/*
+ * one table per output format, so the format can be chosen at runtime. The
+ * 8 and 16-bit tables have spare entries past the 256, so a 32-bit gather
+ * from any entry stays in bounds
+ */
+#define MDC_SINPAD8 3
+#define MDC_SINPAD16 1
+
+/* MDC_SAMPLE_U8 */
 
 #if defined(MDC_ENCODE_FULL_AMPLITUDE)
 
-static mdc_sample_t sintable[] = {
+static const mdc_u8_t sintable_u8[256 + MDC_SINPAD8] = {
       127, 130, 133, 136, 139, 142, 145, 148, 151, 154, 157, 160, 163, 166, 169, 172,
 	  175, 178, 180, 183, 186, 189, 191, 194, 196, 199, 201, 204, 206, 209, 211, 213,
 	  215, 218, 220, 222, 224, 226, 227, 229, 231, 233, 234, 236, 237, 239, 240, 241,
@@ -64,7 +79,7 @@ static mdc_sample_t sintable[] = {
 #else
 
 
-static mdc_sample_t sintable[] = {
+static const mdc_u8_t sintable_u8[256 + MDC_SINPAD8] = {
 	128, 130, 132, 134, 136, 138, 140, 142, 144, 146, 148, 150, 152, 154, 156, 158, 
 	160, 162, 164, 166, 168, 170, 172, 172, 174, 176, 178, 180, 182, 182, 184, 186, 
 	188, 190, 190, 192, 194, 194, 196, 198, 198, 200, 200, 202, 202, 204, 204, 206, 
@@ -84,11 +99,11 @@ static mdc_sample_t sintable[] = {
 
 #endif
 
-#elif defined(MDC_SAMPLE_FORMAT_U16)
+/* MDC_SAMPLE_U16 */
 
 #if defined(MDC_ENCODE_FULL_AMPLITUDE)
 
-static mdc_sample_t sintable[] = {
+static const mdc_u16_t sintable_u16[256 + MDC_SINPAD16] = {
 	32768, 33552, 34337, 35120, 35902, 36682, 37460, 38235,
 	39007, 39775, 40538, 41297, 42051, 42799, 43542, 44277,
 	45006, 45728, 46441, 47147, 47843, 48531, 49209, 49877,
@@ -124,7 +139,7 @@ static mdc_sample_t sintable[] = {
 
 #else
 
-static mdc_sample_t sintable[] = {
+static const mdc_u16_t sintable_u16[256 + MDC_SINPAD16] = {
 	32768, 33314, 33861, 34407, 34952, 35495, 36037, 36577, 37115, 37650, 38182, 38710, 39236, 39757, 40274, 40787, 
 	41295, 41797, 42294, 42786, 43271, 43750, 44223, 44688, 45147, 45598, 46041, 46476, 46903, 47322, 47731, 48132, 
 	48523, 48905, 49278, 49640, 49992, 50334, 50665, 50985, 51295, 51593, 51880, 52155, 52419, 52671, 52910, 53138, 
@@ -144,10 +159,10 @@ static mdc_sample_t sintable[] = {
 
 #endif
 
-#elif defined(MDC_SAMPLE_FORMAT_S16)
+/* MDC_SAMPLE_S16 */
 
 #if defined(MDC_ENCODE_FULL_AMPLITUDE)
-static mdc_sample_t sintable[] = {
+static const mdc_s16_t sintable_s16[256 + MDC_SINPAD16] = {
 	     0,    784,   1569,   2352,   3134,   3914,   4692,   5467, 
 	  6239,   7007,   7770,   8529,   9283,  10031,  10774,  11509, 
 	 12238,  12960,  13673,  14379,  15075,  15763,  16441,  17109, 
@@ -181,7 +196,7 @@ static mdc_sample_t sintable[] = {
 	-12238, -11509, -10774, -10031,  -9283,  -8529,  -7770,  -7007,
 	 -6239,  -5467,  -4692,  -3914,  -3134,  -2352,  -1569,   -784 };
 #else
-static mdc_sample_t sintable[] = {
+static const mdc_s16_t sintable_s16[256 + MDC_SINPAD16] = {
 
 	0, 546, 1093, 1639, 2184, 2727, 3269, 3809, 4347, 4882, 5414, 5942, 6468, 6989, 7506, 8019, 
 	8527, 9029, 9526, 10018, 10503, 10982, 11455, 11920, 12379, 12830, 13273, 13708, 14135, 14554, 14963, 15364, 
@@ -202,10 +217,10 @@ static mdc_sample_t sintable[] = {
 
 #endif
 
-#elif defined(MDC_SAMPLE_FORMAT_FLOAT)
+/* MDC_SAMPLE_FLOAT */
 
 #if defined(MDC_ENCODE_FULL_AMPLITUDE)
-static mdc_sample_t sintable[] = {
+static const float sintable_float[] = {
 	 0.000000,  0.024541,  0.049068,  0.073565,  0.098017,  0.122411,  0.146730,  0.170962,
 	 0.195090,  0.219101,  0.242980,  0.266713,  0.290285,  0.313682,  0.336890,  0.359895,
 	 0.382683,  0.405241,  0.427555,  0.449611,  0.471397,  0.492898,  0.514103,  0.534998,
@@ -239,7 +254,7 @@ static mdc_sample_t sintable[] = {
 	-0.382683, -0.359895, -0.336890, -0.313682, -0.290285, -0.266713, -0.242980, -0.219101,
 	-0.195090, -0.170962, -0.146730, -0.122411, -0.098017, -0.073565, -0.049068, -0.024541 };
 #else
-static mdc_sample_t sintable[] = {
+static const float sintable_float[] = {
 	0.000000, 0.016688, 0.033366, 0.050024, 0.066652, 0.083239, 0.099777, 0.116254, 
 	0.132661, 0.148989, 0.165227, 0.181365, 0.197394, 0.213304, 0.229085, 0.244729, 
 	0.260225, 0.275564, 0.290737, 0.305736, 0.320550, 0.335171, 0.349590, 0.363798, 
@@ -275,20 +290,139 @@ static mdc_sample_t sintable[] = {
 
 #endif
 
+
+/*
+ * tone runs: samples stepping the tone phase t by inc from one to the next.
+ * With AVX2 the phases of 8 samples are stepped together and their table
+ * entries gathered at once, leaving only the tail of a run to the scalar
+ * loop in _enc_run. Without a gather there's nothing to gain from SIMD here:
+ * stepping phases 4 at a time only to look them up one by one is no faster
+ */
+#ifdef MDC_SIMD
+
+#ifdef __AVX2__
+#define _AVX2	// built for AVX2, no need to check at runtime
 #else
-#error "no known sample format defined"
+#define _AVX2 __attribute__((target("avx2")))
 #endif
 
-mdc_encoder_t * mdc_encoder_new(int sampleRate)
+#define MDC_RUNV 8
+
+// phases of the next 8 samples, and the step from one group to the next
+#define _RUN_START(t, inc, ph, step) \
+	__m256i ph = _mm256_add_epi32(_mm256_set1_epi32((int)(t)), \
+	                              _mm256_mullo_epi32(_mm256_set1_epi32((int)(inc)), _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 8))); \
+	__m256i step = _mm256_set1_epi32((int)((inc) * MDC_RUNV))
+#define _RUN_INDEX(ph) _mm256_srli_epi32(ph, 24)
+
+// each renders the first n & ~7 samples of a run, returning how many that was
+_AVX2 static mdc_int_t _enc_run8_u8(void *buffer, mdc_u32_t t, mdc_u32_t inc, mdc_int_t n)
 {
-	mdc_encoder_t *encoder;
+	mdc_u8_t *out = (mdc_u8_t *)buffer;
+	mdc_int_t i;
+	_RUN_START(t, inc, ph, step);
+	__m256i mask = _mm256_set1_epi32(0xff);
 
-	encoder = (mdc_encoder_t *)malloc(sizeof(mdc_encoder_t));
-	if(!encoder)
-		return (mdc_encoder_t *) 0L;
+	for(i=0; i + MDC_RUNV <= n; i += MDC_RUNV)
+	{
+		__m256i v = _mm256_and_si256(_mm256_i32gather_epi32((const int *)sintable_u8, _RUN_INDEX(ph), 1), mask);
+		__m128i w = _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+
+		_mm_storel_epi64((__m128i *)(out + i), _mm_packus_epi16(w, w));
+		ph = _mm256_add_epi32(ph, step);
+	}
+	return i;
+}
+
+_AVX2 static mdc_int_t _enc_run8_s16(void *buffer, mdc_u32_t t, mdc_u32_t inc, mdc_int_t n)
+{
+	mdc_s16_t *out = (mdc_s16_t *)buffer;
+	mdc_int_t i;
+	_RUN_START(t, inc, ph, step);
+
+	for(i=0; i + MDC_RUNV <= n; i += MDC_RUNV)
+	{
+		// the low half of each gathered word is the entry; sign-extend it to pack
+		__m256i v = _mm256_i32gather_epi32((const int *)sintable_s16, _RUN_INDEX(ph), 2);
+
+		v = _mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16);
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+		ph = _mm256_add_epi32(ph, step);
+	}
+	return i;
+}
+
+_AVX2 static mdc_int_t _enc_run8_u16(void *buffer, mdc_u32_t t, mdc_u32_t inc, mdc_int_t n)
+{
+	mdc_u16_t *out = (mdc_u16_t *)buffer;
+	mdc_int_t i;
+	_RUN_START(t, inc, ph, step);
+	__m256i mask = _mm256_set1_epi32(0xffff);
+
+	for(i=0; i + MDC_RUNV <= n; i += MDC_RUNV)
+	{
+		__m256i v = _mm256_and_si256(_mm256_i32gather_epi32((const int *)sintable_u16, _RUN_INDEX(ph), 2), mask);
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packus_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1)));
+		ph = _mm256_add_epi32(ph, step);
+	}
+	return i;
+}
+
+_AVX2 static mdc_int_t _enc_run8_float(void *buffer, mdc_u32_t t, mdc_u32_t inc, mdc_int_t n)
+{
+	float *out = (float *)buffer;
+	mdc_int_t i;
+	_RUN_START(t, inc, ph, step);
+
+	for(i=0; i + MDC_RUNV <= n; i += MDC_RUNV)
+	{
+		_mm256_storeu_ps(out + i, _mm256_i32gather_ps(sintable_float, _RUN_INDEX(ph), 4));
+		ph = _mm256_add_epi32(ph, step);
+	}
+	return i;
+}
+
+static mdc_int_t (*_enc_run8[4])(void *buffer, mdc_u32_t t, mdc_u32_t inc, mdc_int_t n);
+
+// pick the AVX2 runs if this CPU has them; only the first call writes, as
+// with the decoder's popcount
+static void _enc_run8_init(void)
+{
+	if(_enc_run8[MDC_SAMPLE_FLOAT])
+		return;
+#ifndef __AVX2__
+	__builtin_cpu_init();
+	if(!__builtin_cpu_supports("avx2"))
+		return;
+#endif
+	_enc_run8[MDC_SAMPLE_U8] = _enc_run8_u8;
+	_enc_run8[MDC_SAMPLE_S16] = _enc_run8_s16;
+	_enc_run8[MDC_SAMPLE_U16] = _enc_run8_u16;
+	_enc_run8[MDC_SAMPLE_FLOAT] = _enc_run8_float;
+}
 
+#else
+
+static void _enc_run8_init(void) { }
+
+#endif
+
+// set up an encoder in given memory, in its post-construction state
+static int _encoder_init(mdc_encoder_t *encoder, int sampleRate)
+{
+	// the 1800 Hz tone's phase must advance less than a full turn per sample
+	if(sampleRate <= 1800)
+		return -1;
+
+	encoder->sampleRate = sampleRate;
 	encoder->loaded = 0;
 	encoder->preamble_set = 0;
+	encoder->preamble_packet = -1;
+	encoder->gap = 0;
+	encoder->gap_count = 0;
+	encoder->pqhead = 0;
+	encoder->pqtail = 0;
 
 	if(sampleRate == 8000)
 	{
@@ -321,9 +455,79 @@ mdc_encoder_t * mdc_encoder_new(int sampleRate)
 		encoder->incru18 = 1800 * 2 * (0x80000000 / sampleRate);
 	}
 
+	encoder->runlen = 0xffffffff / encoder->incru;
+	encoder->runcut = 0xffffffff - encoder->runlen * encoder->incru;
+
+	_enc_run8_init();
+
+	return 0;
+}
+
+mdc_encoder_t * mdc_encoder_new(int sampleRate)
+{
+	mdc_encoder_t *encoder;
+
+	encoder = (mdc_encoder_t *)malloc(sizeof(mdc_encoder_t));
+	if(!encoder)
+		return (mdc_encoder_t *) 0L;
+
+	if(_encoder_init(encoder, sampleRate))
+	{
+		free(encoder);
+		return (mdc_encoder_t *) 0L;
+	}
+	encoder->allocated = 1;
+
 	return encoder;
 }
 
+struct _mdc_encoder_align { char c; mdc_encoder_t e; };
+
+int mdc_encoder_sizeof(void)
+{
+	return sizeof(mdc_encoder_t);
+}
+
+int mdc_encoder_alignof(void)
+{
+	return offsetof(struct _mdc_encoder_align, e);
+}
+
+mdc_encoder_t * mdc_encoder_init(void *mem, int sampleRate)
+{
+	mdc_encoder_t *encoder = (mdc_encoder_t *)mem;
+
+	if(!mem || ((size_t)mem) % mdc_encoder_alignof())
+		return (mdc_encoder_t *) 0L;
+
+	if(_encoder_init(encoder, sampleRate))
+		return (mdc_encoder_t *) 0L;
+	encoder->allocated = 0;
+
+	return encoder;
+}
+
+int mdc_encoder_reset(mdc_encoder_t *encoder)
+{
+	mdc_int_t allocated;
+
+	if(!encoder)
+		return -1;
+
+	allocated = encoder->allocated;
+	if(_encoder_init(encoder, encoder->sampleRate))
+		return -1;
+	encoder->allocated = allocated;
+
+	return 0;
+}
+
+void mdc_encoder_destroy(mdc_encoder_t *encoder)
+{
+	if(encoder && encoder->allocated)
+		free(encoder);
+}
+
 int mdc_encoder_set_preamble(mdc_encoder_t *encoder,
                           int preambleLength)
 {
@@ -357,95 +561,130 @@ static mdc_u8_t * _enc_leader(mdc_u8_t *data)
 	return &(data[12]);
 }
 
+/*
+ * interleave one half of a frame: x holds 8 rows of 7 bits, row r in bits
+ * 7r to 7r+6, and comes back with column c in byte 7-c, row 0 in its top bit
+ */
+static mdc_u64_t _enc_columns(mdc_u64_t x)
+{
+	mdc_u64_t t;
+
+	// one row per byte, row r in byte r
+	x = (x & 0x000000000fffffffULL) | ((x & 0x00fffffff0000000ULL) << 4);
+	x = (x & 0x00003fff00003fffULL) | ((x & 0x0fffc0000fffc000ULL) << 2);
+	x = (x & 0x007f007f007f007fULL) | ((x & 0x3f803f803f803f80ULL) << 1);
+
+	// 8x8 bit transpose about the other diagonal: bit 8i+j swaps with
+	// bit 8(7-j)+(7-i)
+	t = (x ^ (x >> 9)) & 0x0055005500550055ULL;
+	x ^= t ^ (t << 9);
+	t = (x ^ (x >> 18)) & 0x0000333300003333ULL;
+	x ^= t ^ (t << 18);
+	t = (x ^ (x >> 36)) & 0x000000000f0f0f0fULL;
+	x ^= t ^ (t << 36);
+
+	return x;
+}
+
 static mdc_u8_t * _enc_str(mdc_u8_t *data)
 {
 	mdc_u16_t ccrc;
-	mdc_int_t i, j;
-	mdc_int_t k;
-	mdc_int_t m;
-	mdc_int_t csr[7];
-	mdc_int_t b;
-	mdc_int_t lbits[112];
+	mdc_u64_t d, s;
+	mdc_int_t i;
 
 	ccrc = _docrc(data, 4);
 
 	data[4] = ccrc & 0x00ff;
 	data[5] = (ccrc >> 8) & 0x00ff;
 
-	data[6] = 0; 
+	data[6] = 0;
 
-	for(i=0; i<7; i++)
-		csr[i] = 0;
+	d = 0;
+	for(i=0; i<6; i++)
+		d |= ((mdc_u64_t)data[i]) << (8*i);
 
-	for(i=0; i<7; i++)
-	{
-		data[i+7] = 0;
-		for(j=0; j<=7; j++)
-		{
-			for(k=6; k > 0; k--)
-				csr[k] = csr[k-1];
-			csr[0] = (data[i] >> j) & 0x01;
-			b = csr[0] + csr[2] + csr[5] + csr[6];
-			data[i+7] |= (b & 0x01) << j;
-		}
-	}
-
-	k=0;
-	m=0;
-	for(i=0; i<14; i++)
-	{
-		for(j=0; j<=7; j++)
-		{
-			b = 0x01 & (data[i] >> j);
-			lbits[k] = b;
-			k += 16; 
-			if(k > 111)
-				k = ++m;
-		}
-	}
+	// parity stream, bits taken LSB first: each parity bit is the data bit
+	// with those 2, 5 and 6 before it
+	s = (d ^ (d << 2) ^ (d << 5) ^ (d << 6)) & 0x00ffffffffffffffULL;
 
-	k = 0;
-	for(i=0; i<14; i++)
+	// the 112 bits go out as 16 rows of 7 read down the columns; the data
+	// is rows 0-7 and the parity rows 8-15, so column c is bytes 2c, 2c+1
+	d = _enc_columns(d);
+	s = _enc_columns(s);
+	for(i=0; i<7; i++)
 	{
-		data[i] = 0;
-		for(j=7; j>=0; j--)
-		{
-			if(lbits[k])
-				data[i] |= 1<<j;
-			++k;
-		}
+		data[2*i] = (mdc_u8_t)(d >> (56 - 8*i));
+		data[2*i+1] = (mdc_u8_t)(s >> (56 - 8*i));
 	}
 
-
 	return &(data[14]);
 }
 
-int mdc_encoder_set_packet(mdc_encoder_t *encoder,
-                           unsigned char op,
-			   unsigned char arg,
-			   unsigned short unitID)
+// lay out a normal-length packet in data, returning its length in bytes
+static mdc_int_t _enc_packet(mdc_u8_t *data,
+                             unsigned char op,
+                             unsigned char arg,
+                             unsigned short unitID)
 {
 	mdc_u8_t *dp;
 
+	dp = _enc_leader(data);
 
-	if(!encoder)
-		return -1;
+	dp[0] = op;
+	dp[1] = arg;
+	dp[2] = (unitID >> 8) & 0x00ff;
+	dp[3] = unitID & 0x00ff;
 
-	if(encoder->loaded)
-		return -1;
+	_enc_str(dp);
 
-	encoder->state = 0;
+	return 26;
+}
+
+// lay out a double-length packet in data, returning its length in bytes
+static mdc_int_t _enc_double_packet(mdc_u8_t *data,
+                                    unsigned char op,
+                                    unsigned char arg,
+                                    unsigned short unitID,
+                                    unsigned char extra0,
+                                    unsigned char extra1,
+                                    unsigned char extra2,
+                                    unsigned char extra3)
+{
+	mdc_u8_t *dp;
 
-	dp = _enc_leader(encoder->data);
+	dp = _enc_leader(data);
 
 	dp[0] = op;
 	dp[1] = arg;
 	dp[2] = (unitID >> 8) & 0x00ff;
 	dp[3] = unitID & 0x00ff;
 
+	dp = _enc_str(dp);
+
+	dp[0] = extra0;
+	dp[1] = extra1;
+	dp[2] = extra2;
+	dp[3] = extra3;
+
 	_enc_str(dp);
 
-	encoder->loaded = 26;
+	return 40;
+}
+
+int mdc_encoder_set_packet(mdc_encoder_t *encoder,
+                           unsigned char op,
+			   unsigned char arg,
+			   unsigned short unitID)
+{
+	if(!encoder)
+		return -1;
+
+	if(encoder->loaded)
+		return -1;
+
+	encoder->state = 0;
+	encoder->preamble_packet = -1;
+	encoder->loaded = _enc_packet(encoder->data, op, arg, unitID);
 
 	return 0;
 }
@@ -459,8 +698,6 @@ int mdc_encoder_set_double_packet(mdc_encoder_t *encoder,
 				  unsigned char extra2,
 				  unsigned char extra3)
 {
-	mdc_u8_t *dp;
-
 	if(!encoder)
 		return -1;
 
@@ -468,81 +705,341 @@ int mdc_encoder_set_double_packet(mdc_encoder_t *encoder,
 		return -1;
 
 	encoder->state = 0;
+	encoder->preamble_packet = -1;
+	encoder->loaded = _enc_double_packet(encoder->data, op, arg, unitID, extra0, extra1, extra2, extra3);
 
-	dp = _enc_leader(encoder->data);
+	return 0;
+}
 
-	dp[0] = op;
-	dp[1] = arg;
-	dp[2] = (unitID >> 8) & 0x00ff;
-	dp[3] = unitID & 0x00ff;
+// the back of the packet queue, or null if it is full
+static mdc_encoder_packet_t * _enc_queue_slot(mdc_encoder_t *encoder)
+{
+	mdc_encoder_packet_t *packet;
 
-	dp = _enc_str(dp);
+	if(encoder->pqhead - encoder->pqtail == MDC_PACKETQ)
+		return (mdc_encoder_packet_t *) 0L;
 
-	dp[0] = extra0;
-	dp[1] = extra1;
-	dp[2] = extra2;
-	dp[3] = extra3;
+	packet = &encoder->packets[encoder->pqhead % MDC_PACKETQ];
+	packet->preamble = encoder->preamble_set;
+	return packet;
+}
 
-	_enc_str(dp);
+int mdc_encoder_queue_packet(mdc_encoder_t *encoder,
+                             unsigned char op,
+                             unsigned char arg,
+                             unsigned short unitID)
+{
+	mdc_encoder_packet_t *packet;
+
+	if(!encoder)
+		return -1;
+
+	if(!encoder->loaded)
+	{
+		mdc_encoder_set_packet(encoder, op, arg, unitID);
+		encoder->preamble_packet = encoder->preamble_set;
+		return 0;
+	}
+
+	packet = _enc_queue_slot(encoder);
+	if(!packet)
+		return -1;
 
-	encoder->loaded = 40;
+	packet->loaded = _enc_packet(packet->data, op, arg, unitID);
+	encoder->pqhead++;
 
 	return 0;
 }
 
-static mdc_sample_t  _enc_get_samp(mdc_encoder_t *encoder)
+int mdc_encoder_queue_double_packet(mdc_encoder_t *encoder,
+                                    unsigned char op,
+                                    unsigned char arg,
+                                    unsigned short unitID,
+                                    unsigned char extra0,
+                                    unsigned char extra1,
+                                    unsigned char extra2,
+                                    unsigned char extra3)
+{
+	mdc_encoder_packet_t *packet;
+
+	if(!encoder)
+		return -1;
+
+	if(!encoder->loaded)
+	{
+		mdc_encoder_set_double_packet(encoder, op, arg, unitID, extra0, extra1, extra2, extra3);
+		encoder->preamble_packet = encoder->preamble_set;
+		return 0;
+	}
+
+	packet = _enc_queue_slot(encoder);
+	if(!packet)
+		return -1;
+
+	packet->loaded = _enc_double_packet(packet->data, op, arg, unitID, extra0, extra1, extra2, extra3);
+	encoder->pqhead++;
+
+	return 0;
+}
+
+int mdc_encoder_queued(mdc_encoder_t *encoder)
+{
+	if(!encoder)
+		return -1;
+
+	return encoder->pqhead - encoder->pqtail;
+}
+
+int mdc_encoder_set_gap(mdc_encoder_t *encoder, int gapSamples)
+{
+	if(!encoder)
+		return -1;
+
+	if(gapSamples < 0)
+		return -1;
+
+	encoder->gap = gapSamples;
+
+	return 0;
+}
+
+/*
+ * step to the next bit at a bit boundary, where the bit clock phase has
+ * just wrapped: the tone for the bit starting here is 1800 Hz if it differs
+ * from the last one, 1200 Hz if not. Returns 0 if the packet has ended
+ */
+static mdc_int_t _enc_bit(mdc_encoder_t *encoder)
 {
 	mdc_int_t b;
-	mdc_int_t ofs;
 
-	mdc_u32_t lthu = encoder->thu;
-	encoder->thu += encoder->incru;
+	encoder->ipos++;
+	if(encoder->ipos > 7)
+	{
+		encoder->ipos = 0;
+		if(encoder->preamble_count == 0)
+			encoder->bpos++;
+		else
+			encoder->preamble_count--;
+
+		if(encoder->bpos >= encoder->loaded)
+		{
+			encoder->state = 0;
+			return 0;
+		}
+	}
+
+	b = 0x01 & (encoder->data[encoder->bpos] >> (7-(encoder->ipos)));
+
+	if(b != encoder->lb)
+	{
+		encoder->xorb = 1;
+		encoder->lb = b;
+	}
+	else
+		encoder->xorb = 0;
+
+	return 1;
+}
+
+#define MDC_ENCBLOCK 256
+
+/* map a block of sintable indices to output samples in the given format */
+static void _enc_map(void *buffer, const mdc_u8_t *ofs, mdc_int_t n, mdc_sample_format_t format)
+{
+	mdc_int_t i;
+
+	switch(format)
+	{
+	case MDC_SAMPLE_U8:
+		for(i=0; i<n; i++)
+			((mdc_u8_t *)buffer)[i] = sintable_u8[ofs[i]];
+		break;
+	case MDC_SAMPLE_S16:
+		for(i=0; i<n; i++)
+			((mdc_s16_t *)buffer)[i] = sintable_s16[ofs[i]];
+		break;
+	case MDC_SAMPLE_U16:
+		for(i=0; i<n; i++)
+			((mdc_u16_t *)buffer)[i] = sintable_u16[ofs[i]];
+		break;
+	case MDC_SAMPLE_FLOAT:
+		for(i=0; i<n; i++)
+			((float *)buffer)[i] = sintable_float[ofs[i]];
+		break;
+	}
+}
+
+/*
+ * render the samples up to (not including) the next bit boundary, at most
+ * n of them, straight into the output format; if boundary is set, the
+ * boundary sample just stepped past by _enc_bit comes first. All of these
+ * take the same tone increment, so they are plain table lookups. Bit
+ * periods can't be cached as ready-made waveforms instead: the bit clock
+ * lands at a fresh fraction of a sample each time, and carries out of the
+ * low bits of the tone phase decide which table entry each sample takes
+ */
+static mdc_int_t _enc_run(mdc_encoder_t *encoder, void *buffer, mdc_int_t n, mdc_int_t boundary, mdc_sample_format_t format)
+{
+	mdc_u32_t t = encoder->tthu;
+	mdc_u32_t inc = encoder->xorb ? encoder->incru18 : encoder->incru;
+	mdc_u32_t d;
+	mdc_int_t i = 0;
+
+	// just after a boundary the phase is under one step, leaving only two
+	// possible run lengths; runlen is the longer, taken up to runcut
+	if(encoder->thu < encoder->incru)
+		d = encoder->runlen - (encoder->thu > encoder->runcut);
+	else
+		d = (0xffffffff - encoder->thu) / encoder->incru;
+	d += boundary;
+	if(d > (mdc_u32_t)n)
+		d = n;
+
+#ifdef MDC_SIMD
+	// short runs (low sample rates) go quicker as plain lookups
+	if(_enc_run8[format] && d >= 2 * MDC_RUNV)
+	{
+		i = _enc_run8[format](buffer, t, inc, d);
+		t += i * inc;
+	}
+#endif
+
+	switch(format)
+	{
+	case MDC_SAMPLE_U8:
+		for(; i<(mdc_int_t)d; i++)
+			((mdc_u8_t *)buffer)[i] = sintable_u8[(t += inc) >> 24];
+		break;
+	case MDC_SAMPLE_S16:
+		for(; i<(mdc_int_t)d; i++)
+			((mdc_s16_t *)buffer)[i] = sintable_s16[(t += inc) >> 24];
+		break;
+	case MDC_SAMPLE_U16:
+		for(; i<(mdc_int_t)d; i++)
+			((mdc_u16_t *)buffer)[i] = sintable_u16[(t += inc) >> 24];
+		break;
+	case MDC_SAMPLE_FLOAT:
+		for(; i<(mdc_int_t)d; i++)
+			((float *)buffer)[i] = sintable_float[(t += inc) >> 24];
+		break;
+	}
 
+	encoder->thu += (d - boundary) * encoder->incru;
+	encoder->tthu = t;
+	return d;
+}
 
-	if(encoder->thu  < lthu) // wrap
+static const mdc_int_t _sample_size[] = {
+	sizeof(mdc_u8_t),	// MDC_SAMPLE_U8
+	sizeof(mdc_s16_t),	// MDC_SAMPLE_S16
+	sizeof(mdc_u16_t),	// MDC_SAMPLE_U16
+	sizeof(float)		// MDC_SAMPLE_FLOAT
+};
+
+static const mdc_u8_t _enc_zero[MDC_ENCBLOCK];	// sintable indices of the zero level
+
+// point the encoder at the first bit of the loaded packet
+static void _enc_first_bit(mdc_encoder_t *encoder)
+{
+	encoder->bpos = 0;
+	encoder->ipos = 0;
+	encoder->state = 1;
+	encoder->xorb = 1;
+	encoder->lb = 0;
+	encoder->preamble_count = encoder->preamble_packet >= 0 ? encoder->preamble_packet : encoder->preamble_set;
+}
+
+// load the next queued packet in place of the one just finished, 0 if none
+static mdc_int_t _enc_next(mdc_encoder_t *encoder)
+{
+	mdc_encoder_packet_t *packet;
+
+	if(encoder->pqhead == encoder->pqtail)
+	{
+		encoder->loaded = 0;
+		return 0;
+	}
+
+	packet = &encoder->packets[encoder->pqtail++ % MDC_PACKETQ];
+	memcpy(encoder->data, packet->data, packet->loaded);
+	encoder->loaded = packet->loaded;
+	encoder->preamble_packet = packet->preamble;
+
+	return 1;
+}
+
+/*
+ * render the loaded packet, and any queued behind it, into buffer until the
+ * last one ends or the buffer is full
+ */
+static mdc_int_t _enc_render(mdc_encoder_t *encoder,
+                             void *buffer,
+                             mdc_int_t bufferSize,
+                             mdc_sample_format_t format)
+{
+	mdc_int_t i, n, boundary, size = _sample_size[format];
+
+	i = 0;
+	boundary = 0;
+	while(i < bufferSize)
 	{
-		encoder->ipos++;
-		if(encoder->ipos > 7)
+		if(encoder->gap_count)
 		{
-			encoder->ipos = 0;
-			if(encoder->preamble_count == 0)
-				encoder->bpos++;
-			else
-				encoder->preamble_count--;
+			n = bufferSize - i < MDC_ENCBLOCK ? bufferSize - i : MDC_ENCBLOCK;
+			if(n > encoder->gap_count)
+				n = encoder->gap_count;
+			_enc_map((mdc_u8_t *)buffer + i * size, _enc_zero, n, format);
+			encoder->gap_count -= n;
+			i += n;
+			continue;
+		}
 
-			if(encoder->bpos >= encoder->loaded)
-			{
-				encoder->state = 0;
-				return sintable[0];
-			}
+		if(encoder->state == 0)
+		{
+			encoder->tthu = 0;
+			encoder->thu = 0;
+			_enc_first_bit(encoder);
 		}
 
-		b = 0x01 & (encoder->data[encoder->bpos] >> (7-(encoder->ipos)));
+		i += _enc_run(encoder, (mdc_u8_t *)buffer + i * size, bufferSize - i, boundary, format);
+		if(i == bufferSize)
+			break;
+
+		// the next sample wraps the bit clock
+		encoder->thu += encoder->incru;
+		boundary = _enc_bit(encoder);
+		if(boundary)
+			continue;
 
-		if(b != encoder->lb)
+		if(_enc_next(encoder) && !encoder->gap)
 		{
-			encoder->xorb = 1;
-			encoder->lb = b;
+			// straight on into the next packet, on this sample
+			_enc_first_bit(encoder);
+			boundary = 1;
+			continue;
 		}
-		else
-			encoder->xorb = 0;
-	}
 
-	if(encoder->xorb)
-		encoder->tthu += encoder->incru18;
-	else
-		encoder->tthu += encoder->incru;
+		// packet over: one last sample at the zero level
+		_enc_map((mdc_u8_t *)buffer + i * size, _enc_zero, 1, format);
+		i++;
 
-	ofs = (int)(encoder->tthu >> 24);
+		if(!encoder->loaded)
+			break;
+		encoder->gap_count = encoder->gap;
+	}
 
-	return sintable[ofs];
+	return i;
 }
 
-int mdc_encoder_get_samples(mdc_encoder_t *encoder,
-                            mdc_sample_t *buffer,
-			    int bufferSize)
+static int _get_samples(mdc_encoder_t *encoder,
+                        void *buffer,
+                        int bufferSize,
+                        mdc_sample_format_t format)
 {
 	mdc_int_t i;
+#ifdef FILL_FINAL
+	mdc_int_t n, size = _sample_size[format];
+#endif
 
 	if(!encoder)
 		return -1;
@@ -550,33 +1047,317 @@ int mdc_encoder_get_samples(mdc_encoder_t *encoder,
 	if(!(encoder->loaded))
 		return 0;
 
-	if(encoder->state == 0)
+	i = _enc_render(encoder, buffer, bufferSize, format);
+
+#ifdef FILL_FINAL
+	while(i < bufferSize)
 	{
-		encoder->tthu = 0;
-		encoder->thu = 0;
-		encoder->bpos = 0;
-		encoder->ipos = 0;
-		encoder->state = 1;
-		encoder->xorb = 1;
-		encoder->lb = 0;
-		encoder->preamble_count = encoder->preamble_set;
+		n = bufferSize - i < MDC_ENCBLOCK ? bufferSize - i : MDC_ENCBLOCK;
+		_enc_map((mdc_u8_t *)buffer + i * size, _enc_zero, n, format);
+		i += n;
 	}
+#endif
 
-	i = 0;
-	while((i < bufferSize) && encoder->state)
+	return i;
+}
+
+int mdc_encoder_get_samples(mdc_encoder_t *encoder,
+                            mdc_sample_t *buffer,
+			    int bufferSize)
+{
+	return _get_samples(encoder, buffer, bufferSize, MDC_SAMPLE_FORMAT);
+}
+
+int mdc_encoder_get_samples_u8(mdc_encoder_t *encoder,
+                               unsigned char *buffer,
+                               int bufferSize)
+{
+	return _get_samples(encoder, buffer, bufferSize, MDC_SAMPLE_U8);
+}
+
+int mdc_encoder_get_samples_s16(mdc_encoder_t *encoder,
+                                short *buffer,
+                                int bufferSize)
+{
+	return _get_samples(encoder, buffer, bufferSize, MDC_SAMPLE_S16);
+}
+
+int mdc_encoder_get_samples_u16(mdc_encoder_t *encoder,
+                                unsigned short *buffer,
+                                int bufferSize)
+{
+	return _get_samples(encoder, buffer, bufferSize, MDC_SAMPLE_U16);
+}
+
+int mdc_encoder_get_samples_float(mdc_encoder_t *encoder,
+                                  float *buffer,
+                                  int bufferSize)
+{
+	return _get_samples(encoder, buffer, bufferSize, MDC_SAMPLE_FLOAT);
+}
+
+/*
+ * rendered packet cache
+ */
+
+mdc_packet_cache_t * mdc_packet_cache_new(int capacity)
+{
+	mdc_packet_cache_t *cache;
+	mdc_u32_t nb;
+	mdc_int_t i;
+
+	if(capacity < 1 || capacity > 0x10000000)
+		return (mdc_packet_cache_t *) 0L;
+
+	cache = (mdc_packet_cache_t *)malloc(sizeof(mdc_packet_cache_t));
+	if(!cache)
+		return (mdc_packet_cache_t *) 0L;
+
+	// at least two buckets per entry keeps the chains short
+	for(nb = 2; nb < 2 * (mdc_u32_t)capacity; nb <<= 1)
+		;
+
+	cache->entries = (mdc_packet_cache_entry_t *)malloc(capacity * sizeof(mdc_packet_cache_entry_t));
+	cache->buckets = (mdc_int_t *)malloc(nb * sizeof(mdc_int_t));
+	if(!cache->entries || !cache->buckets)
 	{
-		buffer[i++] = _enc_get_samp(encoder);
+		free(cache->entries);
+		free(cache->buckets);
+		free(cache);
+		return (mdc_packet_cache_t *) 0L;
 	}
 
-#ifdef FILL_FINAL
-	while(i<bufferSize)
+	for(i=0; i<(mdc_int_t)nb; i++)
+		cache->buckets[i] = -1;
+
+	cache->capacity = capacity;
+	cache->count = 0;
+	cache->bucketMask = nb - 1;
+	cache->newest = -1;
+	cache->oldest = -1;
+	cache->hits = 0;
+	cache->misses = 0;
+
+	return cache;
+}
+
+void mdc_packet_cache_destroy(mdc_packet_cache_t *cache)
+{
+	mdc_int_t i;
+
+	if(!cache)
+		return;
+
+	for(i=0; i<cache->count; i++)
+		free(cache->entries[i].samples);
+	free(cache->entries);
+	free(cache->buckets);
+	free(cache);
+}
+
+// FNV-1a over the key, which has its padding zeroed
+static mdc_u32_t _cache_hash(const mdc_packet_key_t *key)
+{
+	const mdc_u8_t *p = (const mdc_u8_t *)key;
+	mdc_u32_t h = 2166136261u;
+	mdc_int_t i;
+
+	for(i=0; i<(mdc_int_t)sizeof(mdc_packet_key_t); i++)
+		h = (h ^ p[i]) * 16777619u;
+
+	return h;
+}
+
+static void _cache_unlink(mdc_packet_cache_t *cache, mdc_int_t e)
+{
+	mdc_packet_cache_entry_t *entry = &cache->entries[e];
+
+	if(entry->newer >= 0)
+		cache->entries[entry->newer].older = entry->older;
+	else
+		cache->newest = entry->older;
+
+	if(entry->older >= 0)
+		cache->entries[entry->older].newer = entry->newer;
+	else
+		cache->oldest = entry->newer;
+}
+
+static void _cache_push(mdc_packet_cache_t *cache, mdc_int_t e)
+{
+	mdc_packet_cache_entry_t *entry = &cache->entries[e];
+
+	entry->newer = -1;
+	entry->older = cache->newest;
+	if(cache->newest >= 0)
+		cache->entries[cache->newest].newer = e;
+	else
+		cache->oldest = e;
+	cache->newest = e;
+}
+
+// encode a packet from scratch into a new buffer of exactly its length
+static void * _cache_render(const mdc_packet_key_t *key, mdc_int_t *numSamples)
+{
+	mdc_encoder_t encoder;
+	unsigned long bits, max;
+	void *samples, *trimmed;
+	mdc_int_t n, size = _sample_size[key->format];
+
+	if(_encoder_init(&encoder, key->sampleRate))
+		return (void *) 0L;
+	encoder.allocated = 0;
+	encoder.preamble_set = key->preamble;
+
+	if(key->loaded == 40)
+		mdc_encoder_set_double_packet(&encoder, key->op, key->arg, key->unitID,
+		                              key->extra[0], key->extra[1], key->extra[2], key->extra[3]);
+	else
+		mdc_encoder_set_packet(&encoder, key->op, key->arg, key->unitID);
+
+	// no bit period is longer than runlen+1 samples, and one more sample ends the packet
+	bits = ((unsigned long)key->loaded + key->preamble) * 8;
+	if(bits > 0x7fffffffUL / (encoder.runlen + 2))
+		return (void *) 0L;
+	max = bits * (encoder.runlen + 1) + 1;
+
+	samples = malloc(max * size);
+	if(!samples)
+		return (void *) 0L;
+
+	n = _enc_render(&encoder, samples, max, key->format);
+
+	trimmed = realloc(samples, n * size);
+	*numSamples = n;
+	return trimmed ? trimmed : samples;
+}
+
+static const void * _cache_get(mdc_packet_cache_t *cache, const mdc_packet_key_t *key, int *numSamples)
+{
+	mdc_packet_cache_entry_t *entry;
+	mdc_int_t e, *link, n;
+	mdc_u32_t b;
+	void *samples;
+
+	b = _cache_hash(key) & cache->bucketMask;
+	for(e = cache->buckets[b]; e >= 0; e = cache->entries[e].chain)
 	{
-		buffer[i++] = sintable[0];
+		entry = &cache->entries[e];
+		if(!memcmp(&entry->key, key, sizeof(mdc_packet_key_t)))
+		{
+			cache->hits++;
+			if(cache->newest != e)
+			{
+				_cache_unlink(cache, e);
+				_cache_push(cache, e);
+			}
+			*numSamples = entry->numSamples;
+			return entry->samples;
+		}
 	}
-#endif
 
-	if(encoder->state == 0)
-		encoder->loaded = 0;
-	return i;
+	samples = _cache_render(key, &n);
+	if(!samples)
+		return (void *) 0L;
+	cache->misses++;
+
+	if(cache->count < cache->capacity)
+		e = cache->count++;
+	else
+	{
+		// push out the least recently used entry
+		e = cache->oldest;
+		entry = &cache->entries[e];
+		_cache_unlink(cache, e);
+		for(link = &cache->buckets[_cache_hash(&entry->key) & cache->bucketMask]; *link != e; link = &cache->entries[*link].chain)
+			;
+		*link = entry->chain;
+		free(entry->samples);
+	}
+
+	entry = &cache->entries[e];
+	entry->key = *key;
+	entry->samples = samples;
+	entry->numSamples = n;
+	entry->chain = cache->buckets[b];
+	cache->buckets[b] = e;
+	_cache_push(cache, e);
+
+	*numSamples = n;
+	return samples;
+}
+
+// fill in a key, zeroing its padding so keys compare and hash bytewise
+static mdc_int_t _cache_key(mdc_packet_key_t *key,
+                            int sampleRate,
+                            mdc_sample_format_t format,
+                            int preambleLength,
+                            mdc_int_t loaded,
+                            unsigned char op,
+                            unsigned char arg,
+                            unsigned short unitID)
+{
+	if(sampleRate <= 0 || preambleLength < 0 ||
+	   (mdc_int_t)format < MDC_SAMPLE_U8 || format > MDC_SAMPLE_FLOAT)
+		return -1;
+
+	memset(key, 0, sizeof(mdc_packet_key_t));
+	key->sampleRate = sampleRate;
+	key->format = format;
+	key->preamble = preambleLength;
+	key->loaded = loaded;
+	key->op = op;
+	key->arg = arg;
+	key->unitID = unitID;
+
+	return 0;
+}
+
+const void * mdc_packet_cache_get(mdc_packet_cache_t *cache,
+                                  int sampleRate,
+                                  mdc_sample_format_t format,
+                                  int preambleLength,
+                                  unsigned char op,
+                                  unsigned char arg,
+                                  unsigned short unitID,
+                                  int *numSamples)
+{
+	mdc_packet_key_t key;
+
+	if(!cache || !numSamples)
+		return (void *) 0L;
+
+	if(_cache_key(&key, sampleRate, format, preambleLength, 26, op, arg, unitID))
+		return (void *) 0L;
+
+	return _cache_get(cache, &key, numSamples);
 }
 
+const void * mdc_packet_cache_get_double(mdc_packet_cache_t *cache,
+                                         int sampleRate,
+                                         mdc_sample_format_t format,
+                                         int preambleLength,
+                                         unsigned char op,
+                                         unsigned char arg,
+                                         unsigned short unitID,
+                                         unsigned char extra0,
+                                         unsigned char extra1,
+                                         unsigned char extra2,
+                                         unsigned char extra3,
+                                         int *numSamples)
+{
+	mdc_packet_key_t key;
+
+	if(!cache || !numSamples)
+		return (void *) 0L;
+
+	if(_cache_key(&key, sampleRate, format, preambleLength, 40, op, arg, unitID))
+		return (void *) 0L;
+
+	key.extra[0] = extra0;
+	key.extra[1] = extra1;
+	key.extra[2] = extra2;
+	key.extra[3] = extra3;
+
+	return _cache_get(cache, &key, numSamples);
+}
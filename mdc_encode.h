@@ -42,20 +42,40 @@
 
 //#define MDC_ENCODE_FULL_AMPLITUDE	// encode at 100% amplitude (default is 68% amplitude for recommended deviation)
 
+#ifndef MDC_PACKETQ
+ #define MDC_PACKETQ 8	// packets held per encoder behind the one being sent, must be a power of 2
+#endif
+
+typedef struct {
+	mdc_u8_t data[14+14+5+7];
+	mdc_int_t loaded;
+	mdc_int_t preamble;
+} mdc_encoder_packet_t;
+
 typedef struct {
 	mdc_int_t loaded;
 	mdc_int_t bpos;
 	mdc_int_t ipos;
 	mdc_int_t preamble_set;
 	mdc_int_t preamble_count;
+	mdc_int_t preamble_packet;	// preamble of the loaded packet if it was queued, else -1 for preamble_set
 	mdc_u32_t thu;
 	mdc_u32_t tthu;
 	mdc_u32_t incru;
 	mdc_u32_t incru18;
+	mdc_u32_t runlen;	// samples in a bit period that starts no later than runcut into a sample
+	mdc_u32_t runcut;
 	mdc_int_t state;
 	mdc_int_t lb;
 	mdc_int_t xorb;
 	mdc_u8_t data[14+14+5+7];
+	mdc_int_t gap;	// zero-level samples between queued packets, 0 to run them together
+	mdc_int_t gap_count;	// zero-level samples still to go before the loaded packet starts
+	mdc_u32_t pqhead;
+	mdc_u32_t pqtail;
+	mdc_encoder_packet_t packets[MDC_PACKETQ];	// waiting to follow the loaded packet, next at pqtail
+	mdc_int_t sampleRate;
+	mdc_int_t allocated;	// set if created by mdc_encoder_new
 } mdc_encoder_t;
 	
 
@@ -63,13 +83,56 @@ typedef struct {
  mdc_encoder_new
  create a new mdc_encoder object
 
-  parameters: int sampleRate - the sampling rate in Hz
+  parameters: int sampleRate - the sampling rate in Hz, above 1800 Hz
 
   returns: an mdc_encoder object or null if failure
 
 */
 mdc_encoder_t * mdc_encoder_new(int sampleRate);
 
+/*
+ mdc_encoder_sizeof, mdc_encoder_alignof
+ size and alignment, in bytes, of the memory needed by mdc_encoder_init
+
+  returns: size or alignment
+*/
+int mdc_encoder_sizeof(void);
+int mdc_encoder_alignof(void);
+
+/*
+ mdc_encoder_init
+ create an mdc_encoder object in memory supplied by the caller, which must
+ remain valid for as long as the object is used
+
+  parameters: void *mem - at least mdc_encoder_sizeof() bytes, aligned to mdc_encoder_alignof()
+              int sampleRate - the sampling rate in Hz, above 1800 Hz
+
+  returns: an mdc_encoder object (at mem) or null if failure
+
+*/
+mdc_encoder_t * mdc_encoder_init(void *mem, int sampleRate);
+
+/*
+ mdc_encoder_reset
+ return an encoder object to its state when first created, at the same
+ sampling rate. Any packet loaded or queued and not yet fully output is
+ discarded, and the preamble and gap settings are cleared
+
+  parameters: mdc_encoder_t *encoder - pointer to the encoder object
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_encoder_reset(mdc_encoder_t *encoder);
+
+/*
+ mdc_encoder_destroy
+ dispose of an encoder object, freeing it if it was made by mdc_encoder_new
+ (memory given to mdc_encoder_init stays with the caller)
+
+  parameters: mdc_encoder_t *encoder - pointer to the encoder object
+*/
+void mdc_encoder_destroy(mdc_encoder_t *encoder);
+
 /*
  mdc_encoder_set_preamble(mdc_encoder_t *encoder,
                           int preambleLength)
@@ -127,6 +190,71 @@ int mdc_encoder_set_double_packet(mdc_encoder_t *encoder,
                                   unsigned char extra3);
 
 
+/*
+ mdc_encoder_queue_packet
+ queue a normal-length MDC packet to follow any packet already loaded or
+ queued, to be sent as soon as the packets ahead of it are done, within the
+ same mdc_encoder_get_samples call. If nothing is loaded, the packet is
+ loaded at once. The packet takes the preamble length set at the time it
+ is queued
+
+ parameters: mdc_encoder_t *encoder  - pointer to the encoder object
+	     unsigned char op        - the "opcode"
+	     unsigned char arg       - the "argument"
+	     unsigned short unitID   - the "unit ID"
+
+ returns: -1 for error or if MDC_PACKETQ packets are already waiting, 0 otherwise
+
+*/
+int mdc_encoder_queue_packet(mdc_encoder_t *encoder,
+                             unsigned char op,
+                             unsigned char arg,
+                             unsigned short unitID);
+
+/*
+ mdc_encoder_queue_double_packet
+ as mdc_encoder_queue_packet, for a double-length MDC packet
+
+ parameters: as mdc_encoder_set_double_packet
+
+ returns: -1 for error or if MDC_PACKETQ packets are already waiting, 0 otherwise
+
+*/
+int mdc_encoder_queue_double_packet(mdc_encoder_t *encoder,
+                                    unsigned char op,
+                                    unsigned char arg,
+                                    unsigned short unitID,
+                                    unsigned char extra0,
+                                    unsigned char extra1,
+                                    unsigned char extra2,
+                                    unsigned char extra3);
+
+/*
+ mdc_encoder_queued
+ number of packets waiting behind the loaded one
+
+  parameters: mdc_encoder_t *encoder - pointer to the encoder object
+
+  returns: -1 if error, otherwise the number of queued packets
+*/
+int mdc_encoder_queued(mdc_encoder_t *encoder);
+
+/*
+ mdc_encoder_set_gap
+ set the spacing between packets sent back to back from the queue. With a
+ gap, each packet ends as it would alone, the gap follows at the zero level,
+ and the next packet starts afresh. With no gap, the next packet starts on
+ the bit after the last one ends, with the bit clock and tone phase carried
+ straight across
+
+ parameters: mdc_encoder_t *encoder  - pointer to the encoder object
+             int gapSamples - zero-level samples between packets, 0 for none
+
+ returns: -1 for error, 0 otherwise
+*/
+int mdc_encoder_set_gap(mdc_encoder_t *encoder, int gapSamples);
+
+
 /*
  mdc_encoder_get_samples
  get generated output audio samples from encoder
@@ -139,12 +267,159 @@ int mdc_encoder_set_double_packet(mdc_encoder_t *encoder,
 	  into the buffer (will be equal to bufferSize unless the end has
 	  been reached, in which case the last block may be less than
 	  bufferSize and all subsequent calls will return zero, until
-	  a new packet is loaded for transmission
+	  a new packet is loaded for transmission. Queued packets follow
+	  on without a break in the output
 
 */
 int mdc_encoder_get_samples(mdc_encoder_t *encoder,
                             mdc_sample_t *buffer,
                             int bufferSize);
 
-#endif
+/*
+ mdc_encoder_get_samples_u8, _s16, _u16, _float
+ as mdc_encoder_get_samples, but writing samples in the named format
+ regardless of the format set in mdc_types.h:
+   u8    - unsigned 8-bit, 128 is zero level
+   s16   - signed 16-bit
+   u16   - unsigned 16-bit, 32768 is zero level
+   float - -1.0 to 1.0
+*/
+int mdc_encoder_get_samples_u8(mdc_encoder_t *encoder,
+                               unsigned char *buffer,
+                               int bufferSize);
+
+int mdc_encoder_get_samples_s16(mdc_encoder_t *encoder,
+                                short *buffer,
+                                int bufferSize);
+
+int mdc_encoder_get_samples_u16(mdc_encoder_t *encoder,
+                                unsigned short *buffer,
+                                int bufferSize);
+
+int mdc_encoder_get_samples_float(mdc_encoder_t *encoder,
+                                  float *buffer,
+                                  int bufferSize);
+
+
+/*
+ * rendered packet cache
+ *
+ * Keeps the complete audio of recently sent packets, so a packet that is
+ * sent again is handed back without being encoded again. Packets are keyed
+ * by their contents, preamble length, sample rate and sample format; the
+ * amplitude is fixed when the library is built (MDC_ENCODE_FULL_AMPLITUDE),
+ * so every entry shares it. The least recently used entry makes way once
+ * the cache is full.
+ */
+
+typedef struct {
+	mdc_int_t sampleRate;
+	mdc_int_t format;	// an mdc_sample_format_t
+	mdc_int_t preamble;	// preamble length, in bytes
+	mdc_int_t loaded;	// 26 for a normal packet, 40 for a double packet
+	mdc_u16_t unitID;
+	mdc_u8_t op;
+	mdc_u8_t arg;
+	mdc_u8_t extra[4];
+} mdc_packet_key_t;
+
+typedef struct {
+	mdc_packet_key_t key;
+	void *samples;
+	mdc_int_t numSamples;
+	mdc_int_t newer, older;	// neighbours in order of use, -1 at either end
+	mdc_int_t chain;	// next entry in the same hash bucket, -1 at the end
+} mdc_packet_cache_entry_t;
+
+typedef struct {
+	mdc_int_t capacity;
+	mdc_int_t count;	// entries filled
+	mdc_packet_cache_entry_t *entries;
+	mdc_int_t *buckets;	// first entry in each hash bucket, -1 if none
+	mdc_u32_t bucketMask;
+	mdc_int_t newest, oldest;
+	unsigned long hits;	// fetches answered from the cache
+	unsigned long misses;	// fetches that had to encode the packet
+} mdc_packet_cache_t;
+
+
+/*
+ mdc_packet_cache_new
+ create an empty rendered packet cache
+
+  parameters: int capacity - the number of packets to hold
 
+  returns: an mdc_packet_cache object or null if failure
+
+*/
+mdc_packet_cache_t * mdc_packet_cache_new(int capacity);
+
+/*
+ mdc_packet_cache_destroy
+ free a cache and all the audio in it; buffers returned by it must not be
+ used afterwards
+
+  parameters: mdc_packet_cache_t *cache - pointer to the cache object
+*/
+void mdc_packet_cache_destroy(mdc_packet_cache_t *cache);
+
+/*
+ mdc_packet_cache_get
+ get the audio for a normal-length MDC packet, encoding it only if it is
+ not already in the cache. The audio is exactly what an encoder set up
+ with the same preamble and packet would give from mdc_encoder_get_samples
+ in the given format, through the final zero-level sample.
+
+ The buffer belongs to the cache: it must not be written or freed, and
+ stays valid until the entry is pushed out of the cache, which takes
+ fetches of at least capacity other distinct packets after this one, or
+ until the cache is destroyed
+
+ parameters: mdc_packet_cache_t *cache - pointer to the cache object
+             int sampleRate      - the sampling rate in Hz
+             mdc_sample_format_t format - the sample format of the audio
+             int preambleLength  - length of additional preamble (in bytes), as for mdc_encoder_set_preamble
+             unsigned char op    - the "opcode"
+             unsigned char arg   - the "argument"
+             unsigned short unitID - the "unit ID"
+             int *numSamples     - set to the number of samples in the buffer
+
+ returns: the cached audio, or null for error
+
+*/
+const void * mdc_packet_cache_get(mdc_packet_cache_t *cache,
+                                  int sampleRate,
+                                  mdc_sample_format_t format,
+                                  int preambleLength,
+                                  unsigned char op,
+                                  unsigned char arg,
+                                  unsigned short unitID,
+                                  int *numSamples);
+
+/*
+ mdc_packet_cache_get_double
+ as mdc_packet_cache_get, for a double-length MDC packet
+
+ parameters: as mdc_packet_cache_get, plus
+             unsigned char extra0 - the 1st "extra byte"
+             unsigned char extra1 - the 2nd "extra byte"
+             unsigned char extra2 - the 3rd "extra byte"
+             unsigned char extra3 - the 4th "extra byte"
+
+ returns: the cached audio, or null for error
+
+*/
+const void * mdc_packet_cache_get_double(mdc_packet_cache_t *cache,
+                                         int sampleRate,
+                                         mdc_sample_format_t format,
+                                         int preambleLength,
+                                         unsigned char op,
+                                         unsigned char arg,
+                                         unsigned short unitID,
+                                         unsigned char extra0,
+                                         unsigned char extra1,
+                                         unsigned char extra2,
+                                         unsigned char extra3,
+                                         int *numSamples);
+
+#endif
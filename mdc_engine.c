@@ -0,0 +1,573 @@
+/*-
+ * mdc_engine.c
+ *   Decodes many channels at once on a set of worker threads, with
+ *   per-channel ordering and work stealing between threads.
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE	// CPU affinity
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "mdc_engine.h"
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#endif
+
+#define MDC_ENGINE_BATCH 8	// blocks decoded on a channel before it goes back on a run queue
+#define MDC_ENGINE_NODES 64	// NUMA nodes looked for
+
+/*
+ * A channel with blocks waiting is on exactly one worker's run queue, or
+ * being run by exactly one worker, never both: so its blocks are decoded
+ * one at a time, in order. Workers take channels from the back of their
+ * own queue, and when that is empty, from the front of another's.
+ * A stolen channel still goes back to its home worker's queue afterwards.
+ */
+
+static void _runq_push(mdc_engine_worker_t *w, mdc_int_t channel)
+{
+	pthread_mutex_lock(&w->lock);
+	w->runq[(w->front + w->back) % w->size] = channel;
+	w->back++;
+	pthread_mutex_unlock(&w->lock);
+}
+
+// front is the index of the oldest entry, back the number of entries
+static mdc_int_t _runq_pop(mdc_engine_worker_t *w, mdc_int_t steal)
+{
+	mdc_int_t channel = -1;
+
+	pthread_mutex_lock(&w->lock);
+	if(w->back)
+	{
+		if(steal)
+		{
+			channel = w->runq[w->front];
+			w->front = (w->front + 1) % w->size;
+		}
+		else
+			channel = w->runq[(w->front + w->back - 1) % w->size];
+		w->back--;
+	}
+	pthread_mutex_unlock(&w->lock);
+
+	return channel;
+}
+
+static mdc_int_t _steal(mdc_engine_t *engine, mdc_engine_worker_t *w, mdc_int_t sameNode)
+{
+	mdc_engine_worker_t *v;
+	mdc_int_t i, channel;
+
+	for(i=1; i<engine->numWorkers; i++)
+	{
+		v = &engine->workers[(w->index + i) % engine->numWorkers];
+		if((v->node == w->node) != sameNode)
+			continue;
+		channel = _runq_pop(v, 1);
+		if(channel >= 0)
+		{
+			__atomic_add_fetch(&w->steals, 1, __ATOMIC_RELAXED);
+			if(!sameNode && v->node >= 0 && w->node >= 0)
+				__atomic_add_fetch(&w->crossNode, 1, __ATOMIC_RELAXED);
+			return channel;
+		}
+	}
+
+	return -1;
+}
+
+static mdc_int_t _take(mdc_engine_t *engine, mdc_engine_worker_t *w)
+{
+	mdc_int_t channel;
+
+	channel = _runq_pop(w, 0);
+	if(channel < 0 && !(engine->flags & MDC_ENGINE_STICKY))
+	{
+		// the nearest memory first
+		channel = _steal(engine, w, 1);
+		if(channel < 0)
+			channel = _steal(engine, w, 0);
+	}
+
+	if(channel >= 0)
+		__atomic_sub_fetch(&engine->runnable, 1, __ATOMIC_SEQ_CST);
+
+	return channel;
+}
+
+static void _wake(mdc_engine_t *engine, mdc_engine_worker_t *home)
+{
+	__atomic_add_fetch(&engine->runnable, 1, __ATOMIC_SEQ_CST);
+
+	if(engine->flags & MDC_ENGINE_STICKY)
+	{
+		// nobody else may take it, so wake the home worker itself
+		pthread_mutex_lock(&home->lock);
+		pthread_cond_signal(&home->work);
+		pthread_mutex_unlock(&home->lock);
+	}
+	else if(__atomic_load_n(&engine->sleeping, __ATOMIC_SEQ_CST))
+	{
+		pthread_mutex_lock(&engine->lock);
+		pthread_cond_signal(&engine->work);
+		pthread_mutex_unlock(&engine->lock);
+	}
+}
+
+static void _run_channel(mdc_engine_t *engine, mdc_engine_worker_t *w, mdc_int_t channel)
+{
+	mdc_engine_channel_t *c = &engine->channels[channel];
+	mdc_engine_job_t *job;
+	mdc_int_t n;
+
+	for(n=0; ; n++)
+	{
+		pthread_mutex_lock(&c->lock);
+		job = c->head;
+		if(!job)
+		{
+			c->queued = 0;
+			pthread_mutex_unlock(&c->lock);
+			return;
+		}
+		if(n == MDC_ENGINE_BATCH)
+		{
+			// more waiting: let other channels have a turn first
+			pthread_mutex_unlock(&c->lock);
+			_runq_push(&engine->workers[c->home], channel);
+			_wake(engine, &engine->workers[c->home]);
+			return;
+		}
+		c->head = job->next;
+		if(!c->head)
+			c->tail = (mdc_engine_job_t *)0L;
+		pthread_mutex_unlock(&c->lock);
+
+		mdc_decoder_process_samples(c->decoder, job->samples, job->numSamples);
+		free(job);
+		__atomic_add_fetch(&w->jobs, 1, __ATOMIC_RELAXED);
+
+		if(__atomic_sub_fetch(&engine->pending, 1, __ATOMIC_SEQ_CST) == 0)
+		{
+			pthread_mutex_lock(&engine->lock);
+			pthread_cond_broadcast(&engine->idle);
+			pthread_mutex_unlock(&engine->lock);
+		}
+	}
+}
+
+// NUMA node of a CPU, or -1 if there is no way to tell
+static mdc_int_t _cpu_node(mdc_int_t cpu)
+{
+#if defined(__linux__)
+	char path[64];
+	mdc_int_t node;
+
+	for(node=0; node<MDC_ENGINE_NODES; node++)
+	{
+		snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d", cpu, node);
+		if(access(path, F_OK) == 0)
+			return node;
+	}
+#else
+	(void)cpu;
+#endif
+	return -1;
+}
+
+// pin the calling worker to the index'th CPU it is allowed to run on
+static void _pin(mdc_engine_worker_t *w)
+{
+#if defined(__linux__)
+	cpu_set_t allowed, one;
+	mdc_int_t cpu, n, count;
+
+	if(sched_getaffinity(0, sizeof(allowed), &allowed))
+		return;
+	count = CPU_COUNT(&allowed);
+	if(!count)
+		return;
+
+	n = w->index % count;
+	for(cpu=0; cpu<CPU_SETSIZE; cpu++)
+	{
+		if(CPU_ISSET(cpu, &allowed) && n-- == 0)
+			break;
+	}
+
+	CPU_ZERO(&one);
+	CPU_SET(cpu, &one);
+	if(pthread_setaffinity_np(pthread_self(), sizeof(one), &one))
+		return;
+
+	w->cpu = cpu;
+	w->node = _cpu_node(cpu);
+#else
+	(void)w;
+#endif
+}
+
+// decoders for the channels homed on this worker, allocated and first touched here
+static int _worker_channels(mdc_engine_t *engine, mdc_engine_worker_t *w)
+{
+	mdc_int_t i, count;
+
+	count = (engine->numChannels - w->index + engine->numWorkers - 1) / engine->numWorkers;
+	if(count < 1)
+		return 0;
+
+	w->pool = mdc_decoder_pool_new(engine->sampleRate, count, 0);
+	if(!w->pool)
+		return -1;
+
+	for(i=w->index; i<engine->numChannels; i+=engine->numWorkers)
+	{
+		mdc_decoder_t *decoder = mdc_decoder_pool_acquire(w->pool);
+
+		decoder->channel = i;
+		mdc_decoder_set_event_callback(decoder, mdc_event_bus_event_callback, engine->bus);
+		engine->channels[i].decoder = decoder;
+	}
+
+	return 0;
+}
+
+static void _worker_sleep(mdc_engine_t *engine, mdc_engine_worker_t *w)
+{
+	if(engine->flags & MDC_ENGINE_STICKY)
+	{
+		pthread_mutex_lock(&w->lock);
+		while(!__atomic_load_n(&engine->stop, __ATOMIC_SEQ_CST) && !w->back)
+			pthread_cond_wait(&w->work, &w->lock);
+		pthread_mutex_unlock(&w->lock);
+		return;
+	}
+
+	pthread_mutex_lock(&engine->lock);
+	__atomic_add_fetch(&engine->sleeping, 1, __ATOMIC_SEQ_CST);
+	while(!engine->stop && !__atomic_load_n(&engine->runnable, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&engine->work, &engine->lock);
+	__atomic_sub_fetch(&engine->sleeping, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_unlock(&engine->lock);
+}
+
+static void * _worker(void *arg)
+{
+	mdc_engine_worker_t *w = (mdc_engine_worker_t *)arg;
+	mdc_engine_t *engine = w->engine;
+	mdc_int_t channel, failed;
+
+	if(engine->flags & MDC_ENGINE_PIN)
+		_pin(w);
+	failed = _worker_channels(engine, w);
+
+	pthread_mutex_lock(&engine->lock);
+	engine->started++;
+	if(failed)
+		engine->failed = 1;
+	pthread_cond_broadcast(&engine->idle);
+	pthread_mutex_unlock(&engine->lock);
+
+	for(;;)
+	{
+		channel = _take(engine, w);
+		if(channel >= 0)
+		{
+			_run_channel(engine, w, channel);
+			continue;
+		}
+
+		if(__atomic_load_n(&engine->stop, __ATOMIC_SEQ_CST))
+			break;
+		_worker_sleep(engine, w);
+		if(__atomic_load_n(&engine->stop, __ATOMIC_SEQ_CST))
+			break;
+	}
+
+	return (void *)0L;
+}
+
+static void _engine_free(mdc_engine_t *engine)
+{
+	mdc_int_t i;
+
+	if(engine->channels)
+	{
+		for(i=0; i<engine->numChannels; i++)
+		{
+			mdc_engine_job_t *job, *next;
+
+			for(job = engine->channels[i].head; job; job = next)
+			{
+				next = job->next;
+				free(job);
+			}
+			pthread_mutex_destroy(&engine->channels[i].lock);
+		}
+		free(engine->channels);
+	}
+
+	if(engine->workers)
+	{
+		for(i=0; i<engine->numWorkers; i++)
+		{
+			mdc_decoder_pool_destroy(engine->workers[i].pool);
+			free(engine->workers[i].runq);
+			pthread_mutex_destroy(&engine->workers[i].lock);
+			pthread_cond_destroy(&engine->workers[i].work);
+		}
+		free(engine->workers);
+	}
+
+	mdc_event_bus_destroy(engine->bus);
+	pthread_mutex_destroy(&engine->lock);
+	pthread_cond_destroy(&engine->work);
+	pthread_cond_destroy(&engine->idle);
+	free(engine);
+}
+
+static void _engine_stop(mdc_engine_t *engine, mdc_int_t numThreads)
+{
+	mdc_int_t i;
+
+	pthread_mutex_lock(&engine->lock);
+	__atomic_store_n(&engine->stop, 1, __ATOMIC_SEQ_CST);
+	pthread_cond_broadcast(&engine->work);
+	pthread_mutex_unlock(&engine->lock);
+
+	for(i=0; i<engine->numWorkers; i++)
+	{
+		pthread_mutex_lock(&engine->workers[i].lock);
+		pthread_cond_broadcast(&engine->workers[i].work);
+		pthread_mutex_unlock(&engine->workers[i].lock);
+	}
+
+	for(i=0; i<numThreads; i++)
+		pthread_join(engine->workers[i].thread, 0L);
+}
+
+mdc_engine_t * mdc_engine_new(int sampleRate, int numChannels, int numWorkers, int flags)
+{
+	mdc_decoder_config_t config;
+	mdc_engine_t *engine;
+	mdc_int_t i;
+
+	// also does the decoder's one-time setup here, before the workers start
+	if(numChannels < 1 || numWorkers < 1 || mdc_decoder_config_init(&config, sampleRate))
+		return (mdc_engine_t *) 0L;
+
+	engine = (mdc_engine_t *)calloc(1, sizeof(mdc_engine_t));
+	if(!engine)
+		return (mdc_engine_t *) 0L;
+
+	engine->sampleRate = sampleRate;
+	engine->numChannels = numChannels;
+	engine->numWorkers = numWorkers;
+	engine->flags = flags;
+	pthread_mutex_init(&engine->lock, 0L);
+	pthread_cond_init(&engine->work, 0L);
+	pthread_cond_init(&engine->idle, 0L);
+
+	engine->channels = (mdc_engine_channel_t *)calloc(numChannels, sizeof(mdc_engine_channel_t));
+	engine->workers = (mdc_engine_worker_t *)calloc(numWorkers, sizeof(mdc_engine_worker_t));
+	engine->bus = mdc_event_bus_new(MDC_ENGINE_RESULTS);
+	if(!engine->channels || !engine->workers || !engine->bus)
+	{
+		// channel and worker locks are not set up yet
+		free(engine->channels);
+		engine->channels = (mdc_engine_channel_t *)0L;
+		free(engine->workers);
+		engine->workers = (mdc_engine_worker_t *)0L;
+		_engine_free(engine);
+		return (mdc_engine_t *) 0L;
+	}
+
+	for(i=0; i<numChannels; i++)
+	{
+		pthread_mutex_init(&engine->channels[i].lock, 0L);
+		engine->channels[i].home = i % numWorkers;
+	}
+
+	for(i=0; i<numWorkers; i++)
+	{
+		mdc_engine_worker_t *w = &engine->workers[i];
+
+		w->engine = engine;
+		w->index = i;
+		w->cpu = -1;
+		w->node = -1;
+		pthread_mutex_init(&w->lock, 0L);
+		pthread_cond_init(&w->work, 0L);
+		// every channel could be on one queue at once, but never twice
+		w->size = numChannels;
+		w->runq = (mdc_int_t *)malloc(numChannels * sizeof(mdc_int_t));
+		if(!w->runq)
+		{
+			engine->numWorkers = i + 1;
+			_engine_free(engine);
+			return (mdc_engine_t *) 0L;
+		}
+	}
+
+	for(i=0; i<numWorkers; i++)
+	{
+		if(pthread_create(&engine->workers[i].thread, 0L, _worker, &engine->workers[i]))
+		{
+			_engine_stop(engine, i);
+			_engine_free(engine);
+			return (mdc_engine_t *) 0L;
+		}
+	}
+
+	// each worker sets up its own channels' decoders before any work arrives
+	pthread_mutex_lock(&engine->lock);
+	while(engine->started < numWorkers)
+		pthread_cond_wait(&engine->idle, &engine->lock);
+	pthread_mutex_unlock(&engine->lock);
+
+	if(engine->failed)
+	{
+		_engine_stop(engine, numWorkers);
+		_engine_free(engine);
+		return (mdc_engine_t *) 0L;
+	}
+
+	return engine;
+}
+
+void mdc_engine_destroy(mdc_engine_t *engine)
+{
+	if(!engine)
+		return;
+
+	_engine_stop(engine, engine->numWorkers);
+	_engine_free(engine);
+}
+
+int mdc_engine_submit(mdc_engine_t *engine, int channel, const mdc_sample_t *samples, int numSamples)
+{
+	mdc_engine_channel_t *c;
+	mdc_engine_job_t *job;
+	mdc_int_t wasQueued;
+
+	if(!engine || channel < 0 || channel >= engine->numChannels || numSamples < 0 || (numSamples && !samples))
+		return -1;
+
+	job = (mdc_engine_job_t *)malloc(sizeof(mdc_engine_job_t) + numSamples * sizeof(mdc_sample_t));
+	if(!job)
+		return -1;
+
+	job->next = (mdc_engine_job_t *)0L;
+	job->numSamples = numSamples;
+	memcpy(job->samples, samples, numSamples * sizeof(mdc_sample_t));
+
+	__atomic_add_fetch(&engine->pending, 1, __ATOMIC_SEQ_CST);
+
+	c = &engine->channels[channel];
+	pthread_mutex_lock(&c->lock);
+	if(c->tail)
+		c->tail->next = job;
+	else
+		c->head = job;
+	c->tail = job;
+	wasQueued = c->queued;
+	c->queued = 1;
+	pthread_mutex_unlock(&c->lock);
+
+	if(!wasQueued)
+	{
+		_runq_push(&engine->workers[c->home], channel);
+		_wake(engine, &engine->workers[c->home]);
+	}
+
+	return 0;
+}
+
+int mdc_engine_flush(mdc_engine_t *engine)
+{
+	if(!engine)
+		return -1;
+
+	pthread_mutex_lock(&engine->lock);
+	while(__atomic_load_n(&engine->pending, __ATOMIC_SEQ_CST))
+		pthread_cond_wait(&engine->idle, &engine->lock);
+	pthread_mutex_unlock(&engine->lock);
+
+	return 0;
+}
+
+int mdc_engine_get_events(mdc_engine_t *engine, mdc_decoder_event_t *events, int maxEvents)
+{
+	if(!engine)
+		return -1;
+
+	return mdc_event_bus_drain(engine->bus, events, maxEvents);
+}
+
+int mdc_engine_get_stats(mdc_engine_t *engine, int worker, unsigned long *jobs, unsigned long *steals)
+{
+	if(!engine || worker < 0 || worker >= engine->numWorkers)
+		return -1;
+
+	if(jobs)
+		*jobs = __atomic_load_n(&engine->workers[worker].jobs, __ATOMIC_RELAXED);
+	if(steals)
+		*steals = __atomic_load_n(&engine->workers[worker].steals, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+int mdc_engine_get_placement(mdc_engine_t *engine, int worker, int *cpu, int *node, unsigned long *crossNode)
+{
+	if(!engine || worker < 0 || worker >= engine->numWorkers)
+		return -1;
+
+	if(cpu)
+		*cpu = engine->workers[worker].cpu;
+	if(node)
+		*node = engine->workers[worker].node;
+	if(crossNode)
+		*crossNode = __atomic_load_n(&engine->workers[worker].crossNode, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+unsigned long mdc_engine_get_dropped(mdc_engine_t *engine)
+{
+	unsigned long n = 0;
+
+	if(engine)
+		mdc_event_bus_get_stats(engine->bus, 0L, &n);
+
+	return n;
+}
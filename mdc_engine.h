@@ -0,0 +1,210 @@
+/*-
+ * mdc_engine.h
+ *  header for mdc_engine.c - multi-threaded decoding of many channels
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#ifndef _MDC_ENGINE_H_
+#define _MDC_ENGINE_H_
+
+#include <pthread.h>
+
+#include "mdc_decode.h"
+#include "mdc_pool.h"
+#include "mdc_bus.h"
+
+#define MDC_ENGINE_PIN 1	// mdc_engine_new flag: pin each worker thread to its own CPU
+#define MDC_ENGINE_STICKY 2	// mdc_engine_new flag: never run a channel away from its home worker
+
+#ifndef MDC_ENGINE_RESULTS
+ #define MDC_ENGINE_RESULTS 4096	// decoded packets held for the consumer
+#endif
+
+/* one block of samples waiting to be decoded on a channel */
+typedef struct mdc_engine_job {
+	struct mdc_engine_job *next;
+	mdc_int_t numSamples;
+	mdc_sample_t samples[1];	// numSamples long
+} mdc_engine_job_t;
+
+typedef struct {
+	mdc_decoder_t *decoder;
+	pthread_mutex_t lock;
+	mdc_engine_job_t *head;	// blocks in submission order
+	mdc_engine_job_t *tail;
+	mdc_int_t queued;	// set while on a worker's run queue or being run
+	mdc_int_t home;	// worker whose run queue the channel is put on
+} mdc_engine_channel_t;
+
+struct mdc_engine;
+
+typedef struct {
+	struct mdc_engine *engine;
+	mdc_int_t index;
+	pthread_t thread;
+	mdc_int_t cpu;	// CPU pinned to, or -1
+	mdc_int_t node;	// NUMA node of that CPU, or -1
+	mdc_decoder_pool_t *pool;	// decoders of the channels homed here, allocated by this thread
+	pthread_mutex_t lock;
+	pthread_cond_t work;	// for MDC_ENGINE_STICKY, where only this worker can take its channels
+	mdc_int_t *runq;	// ring of runnable channels: owner works at the back, thieves take from the front
+	mdc_int_t front;	// index of the front entry
+	mdc_int_t back;	// number of entries
+	mdc_int_t size;
+	unsigned long jobs;	// blocks decoded; this and the counts below are atomic, read while workers run
+	unsigned long steals;	// channels taken from other workers
+	unsigned long crossNode;	// of those, channels homed on another NUMA node
+} mdc_engine_worker_t;
+
+typedef struct mdc_engine {
+	mdc_int_t sampleRate;
+	mdc_int_t numChannels;
+	mdc_int_t numWorkers;
+	mdc_int_t flags;
+	mdc_engine_channel_t *channels;
+	mdc_engine_worker_t *workers;
+	pthread_mutex_t lock;	// for sleeping and waking only
+	pthread_cond_t work;
+	pthread_cond_t idle;
+	mdc_int_t runnable;	// channels on run queues (atomic)
+	mdc_int_t sleeping;	// workers waiting for work (atomic)
+	mdc_int_t pending;	// blocks submitted and not yet decoded (atomic)
+	mdc_int_t stop;
+	mdc_int_t started;	// workers that have set up their channels
+	mdc_int_t failed;	// set if one of them could not
+	mdc_event_bus_t *bus;	// decoded packets from every channel
+} mdc_engine_t;
+
+
+/*
+ mdc_engine_new
+ create a decoding engine: a decoder for each channel and a set of worker
+ threads that decode the sample blocks submitted for them. Channel i has
+ worker i % numWorkers as its home; each worker allocates and first touches
+ the decoders of its own channels, so with MDC_ENGINE_PIN they are in that
+ worker's NUMA node's memory. Idle workers steal channels from busy ones,
+ from workers on their own node first, unless MDC_ENGINE_STICKY is given
+
+  parameters: int sampleRate - the sampling rate in Hz, for every channel
+              int numChannels - the number of channels
+              int numWorkers - the number of worker threads
+              int flags - 0, or MDC_ENGINE_PIN and/or MDC_ENGINE_STICKY
+
+  returns: an mdc_engine object or null if failure
+
+*/
+mdc_engine_t * mdc_engine_new(int sampleRate, int numChannels, int numWorkers, int flags);
+
+/*
+ mdc_engine_destroy
+ stop the worker threads, discarding any blocks not yet decoded, and free the engine
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+*/
+void mdc_engine_destroy(mdc_engine_t *engine);
+
+/*
+ mdc_engine_submit
+ queue a block of samples for decoding on a channel. Blocks for one channel
+ are decoded in the order submitted; different channels are decoded in
+ parallel. The samples are copied, so the buffer may be reused at once.
+ Submission is safe from any one thread at a time per channel
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+              int channel - the channel index
+              mdc_sample_t *samples - pointer to samples (in format set in mdc_types.h)
+              int numSamples - count of the number of samples in buffer
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_engine_submit(mdc_engine_t *engine, int channel, const mdc_sample_t *samples, int numSamples);
+
+/*
+ mdc_engine_flush
+ wait until every block submitted so far has been decoded
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_engine_flush(mdc_engine_t *engine);
+
+/*
+ mdc_engine_get_events
+ retrieve decoded packets from all channels, oldest first; the event's channel
+ field gives the channel index. Workers never wait for the consumers, and
+ any number of consumer threads may call this at once
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+              mdc_decoder_event_t *events - array to store packets in
+              int maxEvents - size of the events array
+
+  returns: -1 if error, otherwise the number of packets stored
+*/
+int mdc_engine_get_events(mdc_engine_t *engine, mdc_decoder_event_t *events, int maxEvents);
+
+/*
+ mdc_engine_get_stats
+ retrieve counters for one worker thread. May be called while blocks are
+ being decoded, giving counts as they stood at some point during the call
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+              int worker - the worker index
+              unsigned long *jobs - pointer to where to store the number of blocks decoded
+              unsigned long *steals - pointer to where to store the number of channels stolen
+                                      from other workers' run queues
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_engine_get_stats(mdc_engine_t *engine, int worker, unsigned long *jobs, unsigned long *steals);
+
+/*
+ mdc_engine_get_placement
+ retrieve where one worker thread runs, and how often it ran channels whose
+ decoder state is on another NUMA node
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+              int worker - the worker index
+              int *cpu - pointer to where to store the CPU the worker is pinned to, or -1
+              int *node - pointer to where to store that CPU's NUMA node, or -1 if unknown
+              unsigned long *crossNode - pointer to where to store the number of stolen
+                                         channels homed on a worker on another node
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_engine_get_placement(mdc_engine_t *engine, int worker, int *cpu, int *node, unsigned long *crossNode);
+
+/*
+ mdc_engine_get_dropped
+ number of decoded packets discarded because the consumer did not keep up
+
+  parameters: mdc_engine_t *engine - pointer to the engine object
+
+  returns: count
+*/
+unsigned long mdc_engine_get_dropped(mdc_engine_t *engine);
+
+#endif
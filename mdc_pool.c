@@ -0,0 +1,231 @@
+/*-
+ * mdc_pool.c
+ *   Pools of mdc_decoder objects allocated from one contiguous arena,
+ *   for running very many channels with sequential memory access.
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include "mdc_pool.h"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#define MDC_HUGEPAGE (2UL * 1024 * 1024)
+#endif
+
+static int _arena_alloc(mdc_decoder_pool_t *pool, unsigned long size, int flags)
+{
+#if defined(__linux__)
+	void *p = MAP_FAILED;
+
+	pool->hugepages = 0;
+
+#ifdef MAP_HUGETLB
+	if(flags & MDC_POOL_HUGEPAGES)
+	{
+		unsigned long hsize = (size + MDC_HUGEPAGE - 1) & ~(MDC_HUGEPAGE - 1);
+
+		p = mmap(0L, hsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if(p != MAP_FAILED)
+		{
+			size = hsize;
+			pool->hugepages = 1;
+		}
+	}
+#endif
+	if(p == MAP_FAILED)
+	{
+		p = mmap(0L, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(p == MAP_FAILED)
+			return -1;
+#ifdef MADV_HUGEPAGE
+		// no reserved huge pages: ask for transparent ones instead
+		if(flags & MDC_POOL_HUGEPAGES)
+			madvise(p, size, MADV_HUGEPAGE);
+#endif
+	}
+
+	// mmap gives page alignment, which is cache line alignment too
+	pool->arenaAlloc = p;
+	pool->arena = (mdc_u8_t *)p;
+	pool->arenaSize = size;
+#else
+	(void)flags;
+
+	pool->hugepages = 0;
+	pool->arenaAlloc = malloc(size + MDC_CACHELINE);
+	if(!pool->arenaAlloc)
+		return -1;
+
+	pool->arena = (mdc_u8_t *)(((uintptr_t)pool->arenaAlloc + MDC_CACHELINE - 1) & ~(uintptr_t)(MDC_CACHELINE - 1));
+	pool->arenaSize = size;
+#endif
+	return 0;
+}
+
+static void _arena_free(mdc_decoder_pool_t *pool)
+{
+#if defined(__linux__)
+	munmap(pool->arenaAlloc, pool->arenaSize);
+#else
+	free(pool->arenaAlloc);
+#endif
+}
+
+mdc_decoder_pool_t * mdc_decoder_pool_new(int sampleRate, int capacity, int flags)
+{
+	mdc_decoder_pool_t *pool;
+	mdc_int_t i;
+
+	if(capacity < 1)
+		return (mdc_decoder_pool_t *) 0L;
+
+	pool = (mdc_decoder_pool_t *)malloc(sizeof(mdc_decoder_pool_t));
+	if(!pool)
+		return (mdc_decoder_pool_t *) 0L;
+
+	if(mdc_decoder_config_init(&pool->config, sampleRate))
+	{
+		free(pool);
+		return (mdc_decoder_pool_t *) 0L;
+	}
+
+	pool->capacity = capacity;
+	pool->count = 0;
+
+	// whole cache lines per decoder, so no two share a line
+	pool->slotSize = (mdc_decoder_sizeof() + MDC_CACHELINE - 1) & ~(MDC_CACHELINE - 1);
+
+	pool->freeList = (mdc_int_t *)malloc(capacity * sizeof(mdc_int_t));
+	pool->inUse = (mdc_u8_t *)malloc(capacity);
+	if(!pool->freeList || !pool->inUse ||
+	   _arena_alloc(pool, (unsigned long)capacity * pool->slotSize, flags))
+	{
+		free(pool->freeList);
+		free(pool->inUse);
+		free(pool);
+		return (mdc_decoder_pool_t *) 0L;
+	}
+
+	// lowest slots are handed out first
+	for(i=0; i<capacity; i++)
+	{
+		pool->freeList[i] = capacity - 1 - i;
+		pool->inUse[i] = 0;
+	}
+	pool->freeTop = capacity;
+
+	return pool;
+}
+
+void mdc_decoder_pool_destroy(mdc_decoder_pool_t *pool)
+{
+	if(!pool)
+		return;
+
+	_arena_free(pool);
+	free(pool->freeList);
+	free(pool->inUse);
+	free(pool);
+}
+
+mdc_decoder_t * mdc_decoder_pool_acquire(mdc_decoder_pool_t *pool)
+{
+	mdc_decoder_t *decoder;
+	mdc_int_t slot;
+
+	if(!pool || !pool->freeTop)
+		return (mdc_decoder_t *) 0L;
+
+	slot = pool->freeList[--pool->freeTop];
+
+	decoder = mdc_decoder_init_config(pool->arena + (unsigned long)slot * pool->slotSize, &pool->config);
+	decoder->channel = slot;
+
+	pool->inUse[slot] = 1;
+	pool->count++;
+
+	return decoder;
+}
+
+int mdc_decoder_pool_index(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder)
+{
+	unsigned long ofs;
+
+	if(!pool || !decoder)
+		return -1;
+
+	if((mdc_u8_t *)decoder < pool->arena)
+		return -1;
+
+	ofs = (mdc_u8_t *)decoder - pool->arena;
+	if(ofs % pool->slotSize || ofs / pool->slotSize >= (unsigned long)pool->capacity)
+		return -1;
+
+	return ofs / pool->slotSize;
+}
+
+int mdc_decoder_pool_release(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder)
+{
+	mdc_int_t slot;
+
+	slot = mdc_decoder_pool_index(pool, decoder);
+	if(slot < 0 || !pool->inUse[slot])
+		return -1;
+
+	pool->inUse[slot] = 0;
+	pool->freeList[pool->freeTop++] = slot;
+	pool->count--;
+
+	return 0;
+}
+
+mdc_decoder_t * mdc_decoder_pool_next(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder)
+{
+	mdc_int_t slot;
+
+	if(!pool)
+		return (mdc_decoder_t *) 0L;
+
+	if(!decoder)
+		slot = 0;
+	else
+	{
+		slot = mdc_decoder_pool_index(pool, decoder);
+		if(slot < 0)
+			return (mdc_decoder_t *) 0L;
+		slot++;
+	}
+
+	for(; slot < pool->capacity; slot++)
+	{
+		if(pool->inUse[slot])
+			return (mdc_decoder_t *)(pool->arena + (unsigned long)slot * pool->slotSize);
+	}
+
+	return (mdc_decoder_t *) 0L;
+}
@@ -0,0 +1,121 @@
+/*-
+ * mdc_pool.h
+ *  header for mdc_pool.c - pools of decoders allocated from one arena
+ *
+ *  This file is part of Matthew Kaufman's MDC Encoder/Decoder Library
+ *
+ *  The MDC Encoder/Decoder Library is free software; you can
+ *  redistribute it and/or modify it under the terms of version 2 of
+ *  the GNU General Public License as published by the Free Software
+ *  Foundation.
+ *
+ *  If you cannot comply with the terms of this license, contact
+ *  the author for alternative license arrangements or do not use
+ *  or redistribute this software.
+ *
+ *  The MDC Encoder/Decoder Library is distributed in the hope
+ *  that it will be useful, but WITHOUT ANY WARRANTY; without even the
+ *  implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR
+ *  PURPOSE.  See the GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this software; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301
+ *  USA.
+ *
+ *  or see http://www.gnu.org/copyleft/gpl.html
+ *
+-*/
+
+#ifndef _MDC_POOL_H_
+#define _MDC_POOL_H_
+
+#include "mdc_decode.h"
+
+#ifndef MDC_CACHELINE
+ #define MDC_CACHELINE 64	// decoders in a pool start on cache line boundaries
+#endif
+
+#define MDC_POOL_HUGEPAGES 1	// mdc_decoder_pool_new flag: back the arena with huge pages if possible
+
+typedef struct {
+	mdc_decoder_config_t config;	// shared by every decoder in the pool
+	mdc_int_t capacity;
+	mdc_int_t count;	// decoders currently acquired
+	mdc_int_t slotSize;	// bytes from one decoder to the next
+	mdc_int_t hugepages;	// set if the arena is backed by huge pages
+	mdc_u8_t *arena;
+	unsigned long arenaSize;
+	void *arenaAlloc;	// as allocated, before alignment
+	mdc_int_t *freeList;	// stack of free slot indices, freeTop entries deep
+	mdc_int_t freeTop;
+	mdc_u8_t *inUse;	// per slot, set if acquired
+} mdc_decoder_pool_t;
+
+
+/*
+ mdc_decoder_pool_new
+ create a pool of decoders, all carved from one contiguous arena
+
+  parameters: int sampleRate - the sampling rate in Hz, for every decoder in the pool
+              int capacity - the number of decoders in the pool
+              int flags - 0, or MDC_POOL_HUGEPAGES to ask for huge page backing
+                          (falls back to normal pages if none are available)
+
+  returns: an mdc_decoder_pool object or null if failure
+
+*/
+mdc_decoder_pool_t * mdc_decoder_pool_new(int sampleRate, int capacity, int flags);
+
+/*
+ mdc_decoder_pool_destroy
+ free a pool and every decoder in it
+
+  parameters: mdc_decoder_pool_t *pool - pointer to the pool object
+*/
+void mdc_decoder_pool_destroy(mdc_decoder_pool_t *pool);
+
+/*
+ mdc_decoder_pool_acquire
+ take an unused decoder from the pool, in its freshly created state
+
+  parameters: mdc_decoder_pool_t *pool - pointer to the pool object
+
+  returns: a decoder object, or null if the pool is exhausted
+*/
+mdc_decoder_t * mdc_decoder_pool_acquire(mdc_decoder_pool_t *pool);
+
+/*
+ mdc_decoder_pool_release
+ give a decoder back to the pool; it must not be used afterwards
+
+  parameters: mdc_decoder_pool_t *pool - pointer to the pool object
+              mdc_decoder_t *decoder - decoder previously acquired from this pool
+
+  returns: -1 if error, 0 otherwise
+*/
+int mdc_decoder_pool_release(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder);
+
+/*
+ mdc_decoder_pool_next
+ iterate over the acquired decoders of a pool, in order of address
+
+  parameters: mdc_decoder_pool_t *pool - pointer to the pool object
+              mdc_decoder_t *decoder - the previous decoder returned, or null to start
+
+  returns: the next acquired decoder, or null when there are no more
+*/
+mdc_decoder_t * mdc_decoder_pool_next(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder);
+
+/*
+ mdc_decoder_pool_index
+ position of a decoder within its pool, for use as a channel number
+
+  parameters: mdc_decoder_pool_t *pool - pointer to the pool object
+              mdc_decoder_t *decoder - decoder belonging to this pool
+
+  returns: slot index (0 to capacity-1), or -1 if the decoder is not from this pool
+*/
+int mdc_decoder_pool_index(mdc_decoder_pool_t *pool, mdc_decoder_t *decoder);
+
+#endif
@@ -35,14 +35,67 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "mdc_encode.h"
 #include "mdc_decode.h"
+#include "mdc_pool.h"
+#include "mdc_engine.h"
+#include "mdc_bus.h"
+
+/* static copies of the frame coding routines, to check against reference versions */
+#include "mdc_common.c"
 
 void run(mdc_encoder_t *encoder, mdc_decoder_t *decoder, int expect);
 
 void testCallback(int numFrames, unsigned char op, unsigned char arg, unsigned short unitID, unsigned char extra0, unsigned char extra1, unsigned char extra2, unsigned char extra3, void *context);
 
+void runMulti(mdc_encoder_t *encoder, int useCallback);
+
+void runEcc(void);
+
+void runNoise(int sampleRate);
+
+void runFormats(void);
+
+void runEventPath(int sampleRate);
+
+void runGate(int sampleRate);
+
+void runGateFormats(void);
+
+void runMultiModes(void);
+
+void runQueue(void);
+
+void runOffsets(int sampleRate);
+
+void runEarly(int sampleRate, int gate);
+
+void runReuse(void);
+
+void runResetMid(void);
+
+void runPool(int flags);
+
+void runConfig(void);
+
+void runEngine(int numWorkers, int flags);
+
+void runBus(void);
+
+void runPll(int sampleRate);
+
+void runEncodeBlocks(void);
+
+void runCache(void);
+
+void runEncodeQueue(void);
+
+void runPacketLayout(void);
+
+void testMultiCallback(int channel, int numFrames, unsigned char op, unsigned char arg, unsigned short unitID, unsigned char extra0, unsigned char extra1, unsigned char extra2, unsigned char extra3, void *context);
+
 
 
 int main()
@@ -135,7 +188,104 @@ printf("9: ");
 
 	run(encoder, decoder, -2);
 
+	/* multi-channel interleaved decoding */
+
+	runMulti(encoder, 0);
+	runMulti(encoder, 1);
+
+	/* error correction against the original bit-serial version */
+
+	runEcc();
+
+	/* decode rate against noise - output is compared between float and fixed-point builds */
+
+	runNoise(16000);
+	runNoise(48000);
+
+	/* runtime-selected sample formats */
+
+	runFormats();
+
+	/* event-driven decoding against the per-sample path */
+
+	runEventPath(8000);
+	runEventPath(16000);
+	runEventPath(48000);
+
+	/* idle gate across silent stretches */
+
+	runGate(16000);
+	runGate(48000);
+	runGateFormats();
+
+	/* idle gate and PLL on the channels of a multi decoder */
+
+	runMultiModes();
+
+	/* several packets decoded within one call */
+
+	runQueue();
+
+	/* stream positions and timestamps of decoded packets */
+
+	runOffsets(16000);
+	runOffsets(48000);
+
+	/* returning as each packet completes */
+
+	runEarly(16000, 0);
+	runEarly(48000, 0);
+	runEarly(48000, 1000);
+
+	/* objects in caller memory, reset between streams */
+
+	runReuse();
+
+	/* a reset part-way through a packet leaves nothing behind */
+
+	runResetMid();
+
+	/* decoders drawn from a pool */
+
+	runPool(0);
+	runPool(MDC_POOL_HUGEPAGES);
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+	/* decoders sharing one config */
+
+	runConfig();
+
+	/* many channels decoded on worker threads */
+
+	runEngine(1, 0);
+	runEngine(4, 0);
+	runEngine(4, MDC_ENGINE_PIN | MDC_ENGINE_STICKY);
+
+	/* decoded packets handed between threads */
+
+	runBus();
+
+	/* clock recovery in place of the fixed-phase units */
+
+	runPll(16000);
+	runPll(48000);
+
+	/* encoder output whatever the block size */
+
+	runEncodeBlocks();
+
+	/* repeat packets handed back from a cache of rendered audio */
+
+	runCache();
+
+	/* packets queued on the encoder, sent back to back */
+
+	runEncodeQueue();
+
+	/* packet frames laid out as the original bit-serial encoder did */
 
+	runPacketLayout();
 
 
 	fprintf(stderr,"mdc functional test overall success\n");
@@ -359,3 +509,2364 @@ void testCallback(int numFrames, unsigned char op, unsigned char arg, unsigned s
 	// no else required, would have already failed above
 }
 
+
+#define MULTI_CHANNELS 3
+#define MULTI_STRIDE 4
+#define MULTI_SIGNAL 1
+
+int multiChannelFound;
+
+void runMulti(mdc_encoder_t *encoder, int useCallback)
+{
+	mdc_multi_decoder_t *decoder;
+	int rv, rv2, i, c;
+	int cont = 10;
+
+	decoder = mdc_multi_decoder_new(16000, MULTI_CHANNELS);
+	if(!decoder)
+	{
+		fprintf(stderr,"mdc_multi_decoder_new() failed\n");
+		exit(-1);
+	}
+
+	if(useCallback)
+		mdc_multi_decoder_set_callback(decoder, testMultiCallback, (void *) 0x555);
+
+	rv = mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678);
+	if(rv)
+	{
+		fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+		exit(-1);
+	}
+
+	multiChannelFound = -1;
+
+	while(cont)
+	{
+		mdc_sample_t buffer[NUMSAMPLES];
+		mdc_sample_t interleaved[NUMSAMPLES * MULTI_STRIDE];
+
+		rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+		if(rv < 0)
+		{
+			fprintf(stderr,"mdc_encoder_get_samples() failed\n");
+			exit(-1);
+		}
+		else if(rv == 0)
+		{
+			--cont;
+			for(i = 0; i<NUMSAMPLES; i++)
+				buffer[i] = 0;
+			rv = NUMSAMPLES;
+		}
+
+		// signal on one channel, silence on the others, garbage in the unused slot
+		for(i = 0; i<rv; i++)
+		{
+			for(c = 0; c<MULTI_STRIDE; c++)
+				interleaved[i*MULTI_STRIDE + c] = (c == MULTI_SIGNAL) ? buffer[i] : (c < MULTI_CHANNELS ? 0 : 0x1234);
+		}
+
+		rv2 = mdc_multi_decoder_process_interleaved(decoder, interleaved, rv, MULTI_CHANNELS, MULTI_STRIDE);
+		if(rv2 < 0)
+		{
+			fprintf(stderr,"mdc_multi_decoder_process_interleaved() failed\n");
+			exit(-1);
+		}
+		else if(rv2 > 0)
+		{
+			unsigned char op;
+			unsigned char arg;
+			unsigned short unitID;
+
+			if(useCallback || rv2 != 1)
+			{
+				fprintf(stderr,"process interleaved returned %d but expected %d\n", rv2, useCallback ? 0 : 1);
+				exit(-1);
+			}
+
+			for(c = 0; c<MULTI_CHANNELS; c++)
+			{
+				if(mdc_decoder_get_packet(mdc_multi_decoder_get_channel(decoder, c), &op, &arg, &unitID) == 0)
+				{
+					if(op != 0x12 || arg != 0x34 || unitID != 0x5678)
+					{
+						fprintf(stderr,"multi decoder packet doesn't match\n");
+						exit(-1);
+					}
+					multiChannelFound = c;
+				}
+			}
+		}
+	}
+
+	if(multiChannelFound != MULTI_SIGNAL)
+	{
+		fprintf(stderr,"multi decoder found packet on channel %d but expected %d\n", multiChannelFound, MULTI_SIGNAL);
+		exit(-1);
+	}
+
+	mdc_multi_decoder_destroy(decoder);
+
+	printf("multi-channel decode success%s\n", useCallback ? " (callback)" : "");
+}
+
+void testMultiCallback(int channel, int numFrames, unsigned char op, unsigned char arg, unsigned short unitID, unsigned char extra0, unsigned char extra1, unsigned char extra2, unsigned char extra3, void *context)
+{
+	(void)extra0;
+	(void)extra1;
+	(void)extra2;
+	(void)extra3;
+
+	if(context != (void *)0x555)
+	{
+		fprintf(stderr,"context invalid (multi callback)\n");
+		exit(-1);
+	}
+
+	if(numFrames != 1 || op != 0x12 || arg != 0x34 || unitID != 0x5678)
+	{
+		fprintf(stderr,"packet doesn't match (multi callback)\n");
+		exit(-1);
+	}
+
+	multiChannelFound = channel;
+}
+
+
+/*
+ * reference copies of the original bit-serial frame coding, to check the
+ * word-level versions against
+ */
+unsigned int frameSeed;
+
+unsigned char frameByte(void)
+{
+	frameSeed = frameSeed * 1103515245 + 12345;
+	return (unsigned char)(frameSeed >> 16);
+}
+
+// parity bytes 7-13 for data bytes 0-6
+void refParity(unsigned char *data)
+{
+	int i, j, k, b;
+	int csr[7];
+
+	for(i=0; i<7; i++)
+		csr[i] = 0;
+
+	for(i=0; i<7; i++)
+	{
+		data[i+7] = 0;
+		for(j=0; j<=7; j++)
+		{
+			for(k=6; k > 0; k--)
+				csr[k] = csr[k-1];
+			csr[0] = (data[i] >> j) & 0x01;
+			b = csr[0] + csr[2] + csr[5] + csr[6];
+			data[i+7] |= (b & 0x01) << j;
+		}
+	}
+}
+
+void refGofix(unsigned char *data)
+{
+	int i, j, b, k;
+	int csr[7];
+	unsigned int syn;	// unsigned, the syndrome shifts past bit 31
+	int fixi, fixj;
+	int ec;
+
+	syn = 0;
+	for(i=0; i<7; i++)
+		csr[i] = 0;
+
+	for(i=0; i<7; i++)
+	{
+		for(j=0; j<=7; j++)
+		{
+			for(k=6; k > 0; k--)
+				csr[k] = csr[k-1];
+
+			csr[0] = (data[i] >> j) & 0x01;
+			b = csr[0] + csr[2] + csr[5] + csr[6];
+			syn <<= 1;
+			if((b & 0x01) ^ ((data[i+7] >> j) & 0x01))
+				syn |= 1;
+			ec = 0;
+			if(syn & 0x80) ++ec;
+			if(syn & 0x20) ++ec;
+			if(syn & 0x04) ++ec;
+			if(syn & 0x02) ++ec;
+			if(ec >= 3)
+			{
+				syn ^= 0xa6;
+				fixi = i;
+				fixj = j-7;
+				if(fixj < 0)
+				{
+					--fixi;
+					fixj += 8;
+				}
+				if(fixi >= 0)
+					data[fixi] ^= 1<<fixj; // flip
+			}
+		}
+	}
+}
+
+#define ECC_FRAMES 4000
+
+/* valid frames with 0-6 random bit errors, and wholly random ones */
+void runEcc(void)
+{
+	unsigned char a[14], b[14];
+	unsigned short crc;
+	int n, i, k, nerr;
+
+	frameSeed = 3;
+	for(n = 0; n<ECC_FRAMES; n++)
+	{
+		nerr = n % 8;
+		for(i=0; i<4; i++)
+			a[i] = frameByte();
+		crc = _docrc(a, 4);
+		a[4] = crc & 0xff;
+		a[5] = crc >> 8;
+		a[6] = frameByte();
+		refParity(a);
+		if(nerr == 7)
+		{
+			for(i=0; i<14; i++) // entirely random candidate
+				a[i] = frameByte();
+		}
+		else
+		{
+			for(i=0; i<nerr; i++)
+			{
+				k = frameByte() % 112;
+				a[k >> 3] ^= 1 << (k & 7);
+			}
+		}
+
+		memcpy(b, a, 14);
+		refGofix(a);
+		_gofix(b);
+		if(memcmp(a, b, 14))
+		{
+			fprintf(stderr,"runEcc: frame %d (%d errors) corrected differently\n", n, nerr);
+			exit(-1);
+		}
+	}
+
+	printf("error correction success\n");
+}
+
+#define NOISE_PACKETS 40
+#define NOISE_LEVELS 6
+
+unsigned int noiseSeed;
+
+int noiseSample(int amplitude)
+{
+	int i, v = 0;
+	// sum of uniform values, roughly gaussian
+	for(i = 0; i<4; i++)
+	{
+		noiseSeed = noiseSeed * 1103515245 + 12345;
+		v += (int)((noiseSeed >> 16) & 0x7fff) - 0x4000;
+	}
+	return (v / 4) * amplitude / 0x4000;
+}
+
+void runNoise(int sampleRate)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	int level, p, i, rv, found;
+	unsigned char op, arg;
+	unsigned short unitID;
+
+	encoder = mdc_encoder_new(sampleRate);
+	decoder = mdc_decoder_new(sampleRate);
+	if(!encoder || !decoder)
+	{
+		fprintf(stderr,"runNoise: create failed\n");
+		exit(-1);
+	}
+
+	noiseSeed = 1;
+
+	printf("noise sweep %d:", sampleRate);
+	for(level = 0; level<NOISE_LEVELS; level++)
+	{
+		found = 0;
+		for(p = 0; p<NOISE_PACKETS; p++)
+		{
+			int cont = 3;
+
+			if(mdc_encoder_set_packet(encoder, 0x01, p, 0x1000 + p))
+			{
+				fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+				exit(-1);
+			}
+
+			while(cont)
+			{
+				mdc_sample_t buffer[NUMSAMPLES];
+
+				rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES - p);
+				if(rv <= 0)
+				{
+					--cont;
+					for(i = 0; i<NUMSAMPLES; i++)
+						buffer[i] = 0;
+					rv = NUMSAMPLES - p;
+				}
+
+				for(i = 0; i<rv; i++)
+				{
+					int v = buffer[i] + noiseSample(level * 12000);
+					buffer[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+				}
+
+				if(mdc_decoder_process_samples(decoder, buffer, rv) == 1)
+				{
+					if(mdc_decoder_get_packet(decoder, &op, &arg, &unitID) == 0 &&
+					   op == 0x01 && arg == p && unitID == 0x1000 + p)
+						++found;
+				}
+			}
+		}
+		printf(" %d/%d", found, NOISE_PACKETS);
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+	printf("\n");
+}
+
+void runFormats(void)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	int format, rv, rv2;
+	unsigned char op, arg;
+	unsigned short unitID;
+	static const char *names[] = { "u8", "s16", "u16", "float", "clipped float" };
+
+	// the last pass drives float input far past full scale
+	for(format = 0; format<5; format++)
+	{
+		int cont = 3;
+		int found = 0;
+
+		encoder = mdc_encoder_new(16000);
+		decoder = mdc_decoder_new(16000);
+		if(!encoder || !decoder)
+		{
+			fprintf(stderr,"runFormats: create failed\n");
+			exit(-1);
+		}
+
+		if(mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678))
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		while(cont)
+		{
+			union {
+				unsigned char u8[NUMSAMPLES];
+				short s16[NUMSAMPLES];
+				unsigned short u16[NUMSAMPLES];
+				float f[NUMSAMPLES];
+			} buffer;
+			int i;
+
+			switch(format)
+			{
+			case 0: rv = mdc_encoder_get_samples_u8(encoder, buffer.u8, NUMSAMPLES); break;
+			case 1: rv = mdc_encoder_get_samples_s16(encoder, buffer.s16, NUMSAMPLES); break;
+			case 2: rv = mdc_encoder_get_samples_u16(encoder, buffer.u16, NUMSAMPLES); break;
+			default: rv = mdc_encoder_get_samples_float(encoder, buffer.f, NUMSAMPLES); break;
+			}
+			if(format == 4)
+				for(i = 0; i<rv; i++)
+					buffer.f[i] *= 1.0e6f;
+
+			if(rv < 0)
+			{
+				fprintf(stderr,"mdc_encoder_get_samples_%s() failed\n", names[format]);
+				exit(-1);
+			}
+			else if(rv == 0)
+			{
+				--cont;
+				for(i = 0; i<NUMSAMPLES; i++)
+				{
+					switch(format)
+					{
+					case 0: buffer.u8[i] = 128; break;
+					case 1: buffer.s16[i] = 0; break;
+					case 2: buffer.u16[i] = 32768; break;
+					default: buffer.f[i] = 0.0f; break;
+					}
+				}
+				rv = NUMSAMPLES;
+			}
+
+			switch(format)
+			{
+			case 0: rv2 = mdc_decoder_process_samples_u8(decoder, buffer.u8, rv); break;
+			case 1: rv2 = mdc_decoder_process_samples_s16(decoder, buffer.s16, rv); break;
+			case 2: rv2 = mdc_decoder_process_samples_u16(decoder, buffer.u16, rv); break;
+			default: rv2 = mdc_decoder_process_samples_float(decoder, buffer.f, rv); break;
+			}
+
+			if(rv2 == 1)
+			{
+				if(mdc_decoder_get_packet(decoder, &op, &arg, &unitID) < 0 ||
+				   op != 0x12 || arg != 0x34 || unitID != 0x5678)
+				{
+					fprintf(stderr,"%s packet doesn't match\n", names[format]);
+					exit(-1);
+				}
+				++found;
+			}
+			else if(rv2 != 0)
+			{
+				fprintf(stderr,"mdc_decoder_process_samples_%s() returned %d\n", names[format], rv2);
+				exit(-1);
+			}
+		}
+
+		if(found != 1)
+		{
+			fprintf(stderr,"%s format found %d packets, expected 1\n", names[format], found);
+			exit(-1);
+		}
+
+		mdc_encoder_destroy(encoder);
+		mdc_decoder_destroy(decoder);
+
+		printf("%s format decode success\n", names[format]);
+	}
+}
+
+#define EVENTPATH_PACKETS 24
+#define EVENTPATH_EVENTS 64
+
+/*
+ * the same noisy stream through a decoder held to the per-sample path and
+ * one held to the event-driven path: both must report the same packets at
+ * the same stream positions
+ */
+void runEventPath(int sampleRate)
+{
+	static mdc_u64_t mem[2][1024];
+	mdc_decoder_config_t config[2];
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder[2];
+	mdc_decoder_event_t ev[2][EVENTPATH_EVENTS];
+	mdc_sample_t buffer[NUMSAMPLES];
+	int p, i, k, rv, len, cont, n[2];
+
+	if(mdc_decoder_config_init(&config[0], sampleRate))
+	{
+		fprintf(stderr,"runEventPath: mdc_decoder_config_init() failed\n");
+		exit(-1);
+	}
+	config[1] = config[0];
+	config[0].eventdriven = 0;
+	config[1].eventdriven = 1;
+
+	encoder = mdc_encoder_new(sampleRate);
+	decoder[0] = mdc_decoder_init_config(mem[0], &config[0]);
+	decoder[1] = mdc_decoder_init_config(mem[1], &config[1]);
+	if(!encoder || !decoder[0] || !decoder[1])
+	{
+		fprintf(stderr,"runEventPath: create failed\n");
+		exit(-1);
+	}
+
+	noiseSeed = 5;
+	n[0] = n[1] = 0;
+	for(p = 0; p<EVENTPATH_PACKETS; p++)
+	{
+		// singles and doubles alternating, noise rising through the run
+		if(p & 1)
+			rv = mdc_encoder_set_double_packet(encoder, 0x55, p, 0x2000 + p, p, p + 1, p + 2, p + 3);
+		else
+			rv = mdc_encoder_set_packet(encoder, 0x01, p, 0x2000 + p);
+		if(rv)
+		{
+			fprintf(stderr,"runEventPath: set packet failed\n");
+			exit(-1);
+		}
+
+		len = NUMSAMPLES - 7 * p;	// block edges fall somewhere different each time
+		cont = 2;
+		while(cont)
+		{
+			rv = mdc_encoder_get_samples(encoder, buffer, len);
+			if(rv <= 0)
+			{
+				--cont;
+				for(i = 0; i<len; i++)
+					buffer[i] = 0;
+				rv = len;
+			}
+
+			for(i = 0; i<rv; i++)
+			{
+				int v = buffer[i] + noiseSample(p * 3000);
+				buffer[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+			}
+
+			for(k = 0; k<2; k++)
+			{
+				mdc_decoder_process_samples(decoder[k], buffer, rv);
+				n[k] += mdc_decoder_get_events(decoder[k], ev[k] + n[k], EVENTPATH_EVENTS - n[k]);
+			}
+		}
+	}
+
+	if(n[0] != n[1] || n[0] < EVENTPATH_PACKETS / 4)
+	{
+		fprintf(stderr,"runEventPath %d: %d packets per-sample, %d event-driven\n", sampleRate, n[0], n[1]);
+		exit(-1);
+	}
+	for(i = 0; i<n[0]; i++)
+	{
+		if(ev[0][i].frameCount != ev[1][i].frameCount || ev[0][i].op != ev[1][i].op ||
+		   ev[0][i].arg != ev[1][i].arg || ev[0][i].unitID != ev[1][i].unitID ||
+		   ev[0][i].extra0 != ev[1][i].extra0 || ev[0][i].extra3 != ev[1][i].extra3 ||
+		   ev[0][i].syncSample != ev[1][i].syncSample || ev[0][i].endSample != ev[1][i].endSample)
+		{
+			fprintf(stderr,"runEventPath %d: packet %d differs\n", sampleRate, i);
+			exit(-1);
+		}
+	}
+
+	mdc_encoder_destroy(encoder);
+
+	printf("event-driven path %d success\n", sampleRate);
+}
+
+#define GATE_PACKETS 20
+#define GATE_SILENCE 8000
+
+void runGate(int sampleRate)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	int p, i, rv, found;
+	unsigned long blocks, skipped;
+	unsigned char op, arg;
+	unsigned short unitID;
+
+	encoder = mdc_encoder_new(sampleRate);
+	decoder = mdc_decoder_new(sampleRate);
+	if(!encoder || !decoder)
+	{
+		fprintf(stderr,"runGate: create failed\n");
+		exit(-1);
+	}
+
+	if(mdc_decoder_set_gate(decoder, 1000))
+	{
+		fprintf(stderr,"mdc_decoder_set_gate() failed\n");
+		exit(-1);
+	}
+
+	noiseSeed = 1;
+	found = 0;
+
+	for(p = 0; p<GATE_PACKETS; p++)
+	{
+		int silence = GATE_SILENCE + p * 37;
+
+		if(mdc_encoder_set_packet(encoder, 0x01, p, 0x2000 + p))
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		while(silence > 0)
+		{
+			mdc_sample_t buffer[NUMSAMPLES];
+
+			rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+			if(rv <= 0)
+			{
+				rv = silence < NUMSAMPLES ? silence : NUMSAMPLES;
+				silence -= rv;
+				for(i = 0; i<rv; i++)
+					buffer[i] = 0;
+			}
+
+			// low-level background, well under the gate threshold
+			for(i = 0; i<rv; i++)
+				buffer[i] += noiseSample(300);
+
+			if(mdc_decoder_process_samples(decoder, buffer, rv) == 1)
+			{
+				if(mdc_decoder_get_packet(decoder, &op, &arg, &unitID) == 0 &&
+				   op == 0x01 && arg == p && unitID == 0x2000 + p)
+					++found;
+			}
+		}
+	}
+
+	mdc_decoder_get_gate_stats(decoder, &blocks, &skipped);
+
+	if(found != GATE_PACKETS || skipped == 0 || skipped >= blocks)
+	{
+		fprintf(stderr,"runGate %d: found %d/%d, skipped %lu of %lu blocks\n", sampleRate, found, GATE_PACKETS, skipped, blocks);
+		exit(-1);
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+
+	printf("gate %d decode success\n", sampleRate);
+}
+
+#define GATEFMT_SAMPLES 16000
+
+/*
+ * the same square wave as s16 and as float samples, with the gate level just
+ * above and just below its mean absolute level: the formats must agree
+ */
+void runGateFormats(void)
+{
+	static short s16[GATEFMT_SAMPLES];
+	static float f[GATEFMT_SAMPLES];
+	static const int levels[] = { 4500, 5500 };	// mean absolute level is 5000
+	mdc_decoder_t *decoder;
+	unsigned long blocks, skipped[2];
+	int i, l, format;
+
+	for(i = 0; i<GATEFMT_SAMPLES; i++)
+	{
+		s16[i] = (i & 8) ? -5000 : 5000;
+		f[i] = s16[i] / 32768.0f;
+	}
+
+	for(l = 0; l<2; l++)
+	{
+		for(format = 0; format<2; format++)
+		{
+			decoder = mdc_decoder_new(16000);
+			if(!decoder || mdc_decoder_set_gate(decoder, levels[l]))
+			{
+				fprintf(stderr,"runGateFormats: create failed\n");
+				exit(-1);
+			}
+			if(format == 0)
+				mdc_decoder_process_samples_s16(decoder, s16, GATEFMT_SAMPLES);
+			else
+				mdc_decoder_process_samples_float(decoder, f, GATEFMT_SAMPLES);
+			mdc_decoder_get_gate_stats(decoder, &blocks, &skipped[format]);
+			mdc_decoder_destroy(decoder);
+		}
+
+		if(skipped[0] != skipped[1] || (l == 0) != (skipped[0] == 0))
+		{
+			fprintf(stderr,"runGateFormats: level %d skipped %lu blocks for s16, %lu for float\n",
+			        levels[l], skipped[0], skipped[1]);
+			exit(-1);
+		}
+	}
+
+	printf("gate level format success\n");
+}
+
+#define MODES_SAMPLES 60000
+
+/*
+ * channel 0 gated, channel 1 on the PLL: each must give the same packets,
+ * at the same positions, as a single decoder set up the same way, and the
+ * gate must skip the silence around the packets
+ */
+void runMultiModes(void)
+{
+	static mdc_sample_t stream[MODES_SAMPLES], frames[2 * MODES_SAMPLES];
+	mdc_encoder_t *encoder;
+	mdc_multi_decoder_t *multi;
+	mdc_decoder_t *single, *chan;
+	mdc_decoder_event_t ev1[4], ev2[4];
+	unsigned long blocks, skipped;
+	int c, i, p, rv, len, n1, n2;
+
+	encoder = mdc_encoder_new(16000);
+	multi = mdc_multi_decoder_new(16000, 2);
+	if(!encoder || !multi)
+	{
+		fprintf(stderr,"runMultiModes: create failed\n");
+		exit(-1);
+	}
+
+	// two packets with silence around them, on both channels
+	for(i = 0; i<MODES_SAMPLES; i++)
+		stream[i] = 0;
+	len = 5000;
+	for(p = 0; p<2; p++)
+	{
+		mdc_encoder_set_packet(encoder, 0x01, p, 0x2000 + p);
+		while((rv = mdc_encoder_get_samples(encoder, stream + len, MODES_SAMPLES - len)) > 0)
+			len += rv;
+		len += 20000;
+	}
+	for(i = 0; i<MODES_SAMPLES; i++)
+	{
+		frames[2 * i] = stream[i];
+		frames[2 * i + 1] = stream[i];
+	}
+
+	if(mdc_decoder_set_gate(mdc_multi_decoder_get_channel(multi, 0), 200) ||
+	   mdc_decoder_set_pll(mdc_multi_decoder_get_channel(multi, 1), MDC_PLLUNITS))
+	{
+		fprintf(stderr,"runMultiModes: set up failed\n");
+		exit(-1);
+	}
+	for(i = 0; i<MODES_SAMPLES; i += rv)
+	{
+		rv = MODES_SAMPLES - i < 1000 ? MODES_SAMPLES - i : 1000;
+		mdc_multi_decoder_process_interleaved(multi, frames + 2 * i, rv, 2, 2);
+	}
+
+	for(c = 0; c<2; c++)
+	{
+		single = mdc_decoder_new(16000);
+		if(!single)
+		{
+			fprintf(stderr,"runMultiModes: create failed\n");
+			exit(-1);
+		}
+		if(c == 0)
+			mdc_decoder_set_gate(single, 200);
+		else
+			mdc_decoder_set_pll(single, MDC_PLLUNITS);
+		for(i = 0; i<MODES_SAMPLES; i += rv)
+		{
+			rv = MODES_SAMPLES - i < 1000 ? MODES_SAMPLES - i : 1000;
+			mdc_decoder_process_samples(single, stream + i, rv);
+		}
+
+		chan = mdc_multi_decoder_get_channel(multi, c);
+		n1 = mdc_decoder_get_events(single, ev1, 4);
+		n2 = mdc_decoder_get_events(chan, ev2, 4);
+		if(n1 != 2 || n2 != 2)
+		{
+			fprintf(stderr,"runMultiModes: channel %d found %d packets, single decoder %d\n", c, n2, n1);
+			exit(-1);
+		}
+		for(i = 0; i<n1; i++)
+		{
+			if(ev1[i].arg != i || ev2[i].arg != i || ev2[i].channel != c ||
+			   ev1[i].syncSample != ev2[i].syncSample || ev1[i].endSample != ev2[i].endSample)
+			{
+				fprintf(stderr,"runMultiModes: channel %d packet %d differs from single decoder\n", c, i);
+				exit(-1);
+			}
+		}
+
+		if(c == 0)
+		{
+			mdc_decoder_get_gate_stats(chan, &blocks, &skipped);
+			if(skipped == 0 || skipped >= blocks)
+			{
+				fprintf(stderr,"runMultiModes: gate skipped %lu of %lu blocks\n", skipped, blocks);
+				exit(-1);
+			}
+		}
+
+		mdc_decoder_destroy(single);
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_multi_decoder_destroy(multi);
+
+	printf("multi-channel gate and pll success\n");
+}
+
+#define QUEUE_PACKETS (MDC_EVENTQ + 4)
+#define QUEUE_SAMPLES (QUEUE_PACKETS * 8192)
+
+void runQueue(void)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_decoder_event_t events[QUEUE_PACKETS];
+	mdc_sample_t *buffer;
+	int p, i, n, rv;
+	unsigned long decoded, dropped;
+
+	encoder = mdc_encoder_new(16000);
+	decoder = mdc_decoder_new(16000);
+	buffer = (mdc_sample_t *)malloc(QUEUE_SAMPLES * sizeof(mdc_sample_t));
+	if(!encoder || !decoder || !buffer)
+	{
+		fprintf(stderr,"runQueue: create failed\n");
+		exit(-1);
+	}
+
+	// back-to-back bursts, alternating single and double packets, in one buffer
+	n = 0;
+	for(p = 0; p<QUEUE_PACKETS; p++)
+	{
+		if(p & 1)
+			rv = mdc_encoder_set_double_packet(encoder, 0x55, p, 0x3000 + p, 0x0a, 0x0b, 0x0c, p);
+		else
+			rv = mdc_encoder_set_packet(encoder, 0x01, p, 0x3000 + p);
+		if(rv)
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		while((rv = mdc_encoder_get_samples(encoder, buffer + n, QUEUE_SAMPLES - n)) > 0)
+			n += rv;
+
+		for(i = 0; i<400; i++)
+			buffer[n++] = 0;
+	}
+
+	rv = mdc_decoder_process_samples(decoder, buffer, n);
+	if(rv != 1)
+	{
+		fprintf(stderr,"runQueue: process samples returned %d but expected 1\n", rv);
+		exit(-1);
+	}
+
+	mdc_decoder_get_event_stats(decoder, &decoded, &dropped);
+	if(decoded != QUEUE_PACKETS || dropped != QUEUE_PACKETS - MDC_EVENTQ)
+	{
+		fprintf(stderr,"runQueue: decoded %lu dropped %lu\n", decoded, dropped);
+		exit(-1);
+	}
+
+	// the oldest were dropped; the rest come out in order
+	n = mdc_decoder_get_events(decoder, events, 3);
+	n += mdc_decoder_get_events(decoder, events + n, QUEUE_PACKETS - n);
+	if(n != MDC_EVENTQ)
+	{
+		fprintf(stderr,"runQueue: drained %d events but expected %d\n", n, MDC_EVENTQ);
+		exit(-1);
+	}
+
+	for(i = 0; i<n; i++)
+	{
+		p = QUEUE_PACKETS - MDC_EVENTQ + i;
+		if(events[i].frameCount != ((p & 1) ? 2 : 1) || events[i].arg != p || events[i].unitID != 0x3000 + p ||
+		   ((p & 1) && events[i].extra3 != p))
+		{
+			fprintf(stderr,"runQueue: event %d doesn't match\n", i);
+			exit(-1);
+		}
+	}
+
+	if(mdc_decoder_process_samples(decoder, buffer, 0) != 0)
+	{
+		fprintf(stderr,"runQueue: queue not empty after drain\n");
+		exit(-1);
+	}
+
+	free(buffer);
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+
+	printf("queued decode success\n");
+}
+
+#define OFFSET_LEAD 5000
+#define OFFSET_SAMPLES 40000
+#define OFFSET_ANCHOR 240	// a whole number of microseconds at 16000 and 48000
+
+mdc_decoder_event_t offsetEvent;
+int offsetEvents;
+
+void testEventCallback(const mdc_decoder_event_t *event, void *context)
+{
+	if(context != (void *)0x555)
+	{
+		fprintf(stderr,"context invalid (event callback)\n");
+		exit(-1);
+	}
+
+	offsetEvent = *event;
+	++offsetEvents;
+}
+
+void runOffsets(int sampleRate)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_multi_decoder_t *multi;
+	mdc_decoder_event_t ev[4];
+	mdc_sample_t *buffer;
+	int frames, n, i, rv, span, bit, end;
+
+	buffer = (mdc_sample_t *)malloc(OFFSET_SAMPLES * sizeof(mdc_sample_t));
+	if(!buffer)
+	{
+		fprintf(stderr,"runOffsets: create failed\n");
+		exit(-1);
+	}
+
+	bit = sampleRate / 1200 + 1;
+
+	for(frames = 1; frames<=2; frames++)
+	{
+		encoder = mdc_encoder_new(sampleRate);
+		if(!encoder)
+		{
+			fprintf(stderr,"runOffsets: create failed\n");
+			exit(-1);
+		}
+
+		if(frames == 1)
+			rv = mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678);
+		else
+			rv = mdc_encoder_set_double_packet(encoder, 0x55, 0x34, 0x5678, 0x0a, 0x0b, 0x0c, 0x0d);
+		if(rv)
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		for(n = 0; n<OFFSET_LEAD; n++)
+			buffer[n] = 0;
+		while((rv = mdc_encoder_get_samples(encoder, buffer + n, OFFSET_SAMPLES - n)) > 0)
+			n += rv;
+		end = n;
+		for(; n<OFFSET_SAMPLES; n++)
+			buffer[n] = 0;
+
+		// the whole stream in one call, with timestamps in microseconds
+		decoder = mdc_decoder_new(sampleRate);
+		if(!decoder)
+		{
+			fprintf(stderr,"runOffsets: create failed\n");
+			exit(-1);
+		}
+		mdc_decoder_set_timestamp(decoder, 1000000, 1000000);
+		mdc_decoder_process_samples(decoder, buffer, OFFSET_SAMPLES);
+		if(mdc_decoder_get_events(decoder, &ev[0], 1) != 1 || mdc_decoder_get_sample_count(decoder) != OFFSET_SAMPLES)
+		{
+			fprintf(stderr,"runOffsets: no packet found\n");
+			exit(-1);
+		}
+		mdc_decoder_destroy(decoder);
+
+		// odd-sized pieces, reported through the event callback
+		decoder = mdc_decoder_new(sampleRate);
+		if(!decoder)
+		{
+			fprintf(stderr,"runOffsets: create failed\n");
+			exit(-1);
+		}
+		mdc_decoder_set_event_callback(decoder, testEventCallback, (void *)0x555);
+		offsetEvents = 0;
+		for(i = 0; i<OFFSET_SAMPLES; i += rv)
+		{
+			rv = 1 + (i % 509);
+			if(rv > OFFSET_SAMPLES - i)
+				rv = OFFSET_SAMPLES - i;
+			if(mdc_decoder_process_samples(decoder, buffer + i, rv) != 0)
+			{
+				fprintf(stderr,"runOffsets: packet queued with event callback set\n");
+				exit(-1);
+			}
+		}
+		if(offsetEvents != 1)
+		{
+			fprintf(stderr,"runOffsets: event callback called %d times\n", offsetEvents);
+			exit(-1);
+		}
+		ev[1] = offsetEvent;
+		mdc_decoder_destroy(decoder);
+
+		// one sample at a time, as channel 1 of a multi-decoder
+		multi = mdc_multi_decoder_new(sampleRate, 2);
+		if(!multi)
+		{
+			fprintf(stderr,"runOffsets: create failed\n");
+			exit(-1);
+		}
+		for(i = 0; i<OFFSET_SAMPLES; i++)
+		{
+			mdc_sample_t frame[2];
+
+			frame[0] = 0;
+			frame[1] = buffer[i];
+			mdc_multi_decoder_process_interleaved(multi, frame, 1, 2, 2);
+		}
+		if(mdc_decoder_get_events(mdc_multi_decoder_get_channel(multi, 1), &ev[2], 1) != 1)
+		{
+			fprintf(stderr,"runOffsets: no packet found (multi)\n");
+			exit(-1);
+		}
+		mdc_multi_decoder_destroy(multi);
+
+		// the timestamp anchor moved on every block, so the packet ends
+		// well past the anchor in force when it synced
+		decoder = mdc_decoder_new(sampleRate);
+		if(!decoder)
+		{
+			fprintf(stderr,"runOffsets: create failed\n");
+			exit(-1);
+		}
+		for(i = 0; i<OFFSET_SAMPLES; i += OFFSET_ANCHOR)
+		{
+			mdc_decoder_set_timestamp(decoder, 1000000 + (mdc_u64_t)i * 1000000 / sampleRate, 1000000);
+			mdc_decoder_process_samples(decoder, buffer + i, OFFSET_SAMPLES - i < OFFSET_ANCHOR ? OFFSET_SAMPLES - i : OFFSET_ANCHOR);
+		}
+		if(mdc_decoder_get_events(decoder, &ev[3], 1) != 1)
+		{
+			fprintf(stderr,"runOffsets: no packet found (re-anchored)\n");
+			exit(-1);
+		}
+		mdc_decoder_destroy(decoder);
+
+		if(ev[3].endSample - ev[3].syncSample < OFFSET_ANCHOR ||
+		   ev[3].syncTime != ev[0].syncTime || ev[3].endTime != ev[0].endTime)
+		{
+			fprintf(stderr,"runOffsets: re-anchored timestamps %llu %llu, expected %llu %llu\n",
+			        ev[3].syncTime, ev[3].endTime, ev[0].syncTime, ev[0].endTime);
+			exit(-1);
+		}
+
+		for(i = 1; i<4; i++)
+		{
+			if(ev[i].syncSample != ev[0].syncSample || ev[i].endSample != ev[0].endSample)
+			{
+				fprintf(stderr,"runOffsets: positions differ between processing methods\n");
+				exit(-1);
+			}
+		}
+
+		if(ev[0].frameCount != frames || ev[0].channel != 0 || ev[1].channel != 0 || ev[2].channel != 1 ||
+		   ev[1].syncTime != 0)
+		{
+			fprintf(stderr,"runOffsets: event fields don't match\n");
+			exit(-1);
+		}
+
+		// data follows sync directly; the second frame of a double packet follows the first
+		span = (frames == 1 ? 112 : 224) * sampleRate / 1200;
+		if(ev[0].syncSample <= OFFSET_LEAD || ev[0].endSample > (mdc_u64_t)(end + bit) ||
+		   ev[0].endSample - ev[0].syncSample < (mdc_u64_t)(span - 2 * bit) ||
+		   ev[0].endSample - ev[0].syncSample > (mdc_u64_t)(span + 2 * bit))
+		{
+			fprintf(stderr,"runOffsets: sync at %llu end at %llu out of range\n", ev[0].syncSample, ev[0].endSample);
+			exit(-1);
+		}
+
+		if(ev[0].syncTime != 1000000 + ev[0].syncSample * 1000000 / sampleRate ||
+		   ev[0].endTime != 1000000 + ev[0].endSample * 1000000 / sampleRate)
+		{
+			fprintf(stderr,"runOffsets: timestamps don't match\n");
+			exit(-1);
+		}
+
+		mdc_encoder_destroy(encoder);
+	}
+
+	free(buffer);
+
+	printf("packet offsets %d success\n", sampleRate);
+}
+
+#define EARLY_PACKETS 3
+#define EARLY_SAMPLES (EARLY_PACKETS * 24000)
+
+void runEarly(int sampleRate, int gate)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_decoder_event_t whole[EARLY_PACKETS], ev;
+	mdc_sample_t *buffer;
+	int p, i, n, rv, consumed;
+
+	encoder = mdc_encoder_new(sampleRate);
+	buffer = (mdc_sample_t *)malloc(EARLY_SAMPLES * sizeof(mdc_sample_t));
+	if(!encoder || !buffer)
+	{
+		fprintf(stderr,"runEarly: create failed\n");
+		exit(-1);
+	}
+
+	n = 0;
+	for(p = 0; p<EARLY_PACKETS; p++)
+	{
+		if(mdc_encoder_set_packet(encoder, 0x01, p, 0x4000 + p))
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+		while((rv = mdc_encoder_get_samples(encoder, buffer + n, EARLY_SAMPLES - n)) > 0)
+			n += rv;
+		for(i = 0; i<3000; i++)
+			buffer[n++] = 0;
+	}
+
+	// reference: the whole buffer at once
+	decoder = mdc_decoder_new(sampleRate);
+	if(!decoder)
+	{
+		fprintf(stderr,"runEarly: create failed\n");
+		exit(-1);
+	}
+	mdc_decoder_set_gate(decoder, gate);
+	mdc_decoder_process_samples(decoder, buffer, n);
+	if(mdc_decoder_get_events(decoder, whole, EARLY_PACKETS) != EARLY_PACKETS)
+	{
+		fprintf(stderr,"runEarly: reference decode failed\n");
+		exit(-1);
+	}
+	mdc_decoder_destroy(decoder);
+
+	decoder = mdc_decoder_new(sampleRate);
+	if(!decoder)
+	{
+		fprintf(stderr,"runEarly: create failed\n");
+		exit(-1);
+	}
+	mdc_decoder_set_gate(decoder, gate);
+
+	p = 0;
+	i = 0;
+	while(i < n)
+	{
+		rv = mdc_decoder_process_samples_until(decoder, buffer + i, n - i, &consumed);
+		if(rv < 0 || consumed < 1 || consumed > n - i)
+		{
+			fprintf(stderr,"mdc_decoder_process_samples_until() returned %d, consumed %d\n", rv, consumed);
+			exit(-1);
+		}
+		i += consumed;
+
+		if(rv == 0)
+		{
+			if(i != n)
+			{
+				fprintf(stderr,"runEarly: returned early without a packet\n");
+				exit(-1);
+			}
+			continue;
+		}
+
+		// the packet completed on the last sample consumed
+		if(p == EARLY_PACKETS || mdc_decoder_get_events(decoder, &ev, 1) != 1 ||
+		   ev.endSample != (mdc_u64_t)(i - 1) || mdc_decoder_get_sample_count(decoder) != (mdc_u64_t)i ||
+		   ev.arg != p || ev.syncSample != whole[p].syncSample || ev.endSample != whole[p].endSample)
+		{
+			fprintf(stderr,"runEarly: packet %d doesn't match\n", p);
+			exit(-1);
+		}
+		++p;
+	}
+
+	if(p != EARLY_PACKETS)
+	{
+		fprintf(stderr,"runEarly: found %d packets, expected %d\n", p, EARLY_PACKETS);
+		exit(-1);
+	}
+
+	mdc_decoder_destroy(decoder);
+	mdc_encoder_destroy(encoder);
+	free(buffer);
+
+	printf("early return %d%s success\n", sampleRate, gate ? " (gated)" : "");
+}
+
+void runReuse(void)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_u64_t encmem[64], decmem[1024];
+	mdc_sample_t buffer[NUMSAMPLES];
+	int leg, rv, found, cont;
+	unsigned char op, arg;
+	unsigned short unitID;
+
+	if(mdc_encoder_sizeof() > (int)sizeof(encmem) || mdc_decoder_sizeof() > (int)sizeof(decmem) ||
+	   mdc_encoder_alignof() > (int)sizeof(mdc_u64_t) || mdc_decoder_alignof() > (int)sizeof(mdc_u64_t))
+	{
+		fprintf(stderr,"runReuse: objects larger than expected\n");
+		exit(-1);
+	}
+
+	if(mdc_decoder_alignof() > 1 && mdc_decoder_init((char *)decmem + 1, 8000))
+	{
+		fprintf(stderr,"mdc_decoder_init() accepted misaligned memory\n");
+		exit(-1);
+	}
+
+	encoder = mdc_encoder_init(encmem, 8000);
+	decoder = mdc_decoder_init(decmem, 8000);
+	if(encoder != (mdc_encoder_t *)encmem || decoder != (mdc_decoder_t *)decmem)
+	{
+		fprintf(stderr,"runReuse: init failed\n");
+		exit(-1);
+	}
+
+	for(leg = 0; leg<3; leg++)
+	{
+		// abandon a packet part-way through on both sides, then start over
+		if(mdc_encoder_set_packet(encoder, 0x01, 0xee, 0xeeee) ||
+		   mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES / 2) <= 0)
+		{
+			fprintf(stderr,"runReuse: encode failed\n");
+			exit(-1);
+		}
+		mdc_decoder_set_gate(decoder, 1);
+		mdc_decoder_process_samples(decoder, buffer, NUMSAMPLES / 2);
+
+		if(mdc_encoder_reset(encoder) || mdc_decoder_reset(decoder))
+		{
+			fprintf(stderr,"runReuse: reset failed\n");
+			exit(-1);
+		}
+
+		if(mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES) != 0 ||
+		   mdc_decoder_get_sample_count(decoder) != 0 || decoder->gate_level != 0)
+		{
+			fprintf(stderr,"runReuse: state survived reset\n");
+			exit(-1);
+		}
+
+		if(mdc_encoder_set_packet(encoder, 0x12, leg, 0x5678))
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		found = 0;
+		cont = 3;
+		while(cont)
+		{
+			rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+			if(rv <= 0)
+			{
+				--cont;
+				for(rv = 0; rv<NUMSAMPLES; rv++)
+					buffer[rv] = 0;
+			}
+			if(mdc_decoder_process_samples(decoder, buffer, rv) == 1)
+			{
+				if(mdc_decoder_get_packet(decoder, &op, &arg, &unitID) < 0 ||
+				   op != 0x12 || arg != leg || unitID != 0x5678)
+				{
+					fprintf(stderr,"runReuse: packet doesn't match\n");
+					exit(-1);
+				}
+				++found;
+			}
+		}
+
+		if(found != 1)
+		{
+			fprintf(stderr,"runReuse: found %d packets, expected 1\n", found);
+			exit(-1);
+		}
+
+		mdc_encoder_reset(encoder);
+		mdc_decoder_reset(decoder);
+	}
+
+	// caller memory is left alone
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+
+	printf("reused object decode success\n");
+}
+
+#define RESETMID_SAMPLES 12000
+#define RESETMID_EVENTS 8
+
+/*
+ * one decoder reset half-way through a packet, one set up in memory full
+ * of junk: both must be in the same state, and decode a noisy stream alike
+ */
+void runResetMid(void)
+{
+	static mdc_sample_t stream[RESETMID_SAMPLES];
+	static mdc_u64_t junkmem[1024];
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *reset, *fresh, *chan;
+	mdc_multi_decoder_t *multi;
+	mdc_decoder_event_t ev1[RESETMID_EVENTS], ev2[RESETMID_EVENTS];
+	int i, rv, len, n1, n2;
+
+	encoder = mdc_encoder_new(16000);
+	reset = mdc_decoder_new(16000);
+	if(!encoder || !reset || mdc_decoder_sizeof() > (int)sizeof(junkmem))
+	{
+		fprintf(stderr,"runResetMid: create failed\n");
+		exit(-1);
+	}
+
+	// half a packet, then reset
+	mdc_encoder_set_packet(encoder, 0x01, 0xee, 0xeeee);
+	len = mdc_encoder_get_samples(encoder, stream, 300);
+	mdc_decoder_process_samples(reset, stream, len);
+	if(mdc_encoder_reset(encoder) || mdc_decoder_reset(reset))
+	{
+		fprintf(stderr,"runResetMid: reset failed\n");
+		exit(-1);
+	}
+
+	memset(junkmem, 0xa5, sizeof(junkmem));
+	fresh = mdc_decoder_init(junkmem, 16000);
+	if(!fresh)
+	{
+		fprintf(stderr,"runResetMid: init failed\n");
+		exit(-1);
+	}
+
+#ifdef MDC_FOURPOINT
+	if(memcmp(reset->nlevel, fresh->nlevel, sizeof(reset->nlevel)) ||
+	   memcmp(reset->nlstep, fresh->nlstep, sizeof(reset->nlstep)))
+	{
+		fprintf(stderr,"runResetMid: level history survived reset\n");
+		exit(-1);
+	}
+#endif
+
+	// a packet in noise, starting part-way into the stream
+	noiseSeed = 7;
+	mdc_encoder_set_preamble(encoder, 1);
+	mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678);
+	for(i = 0; i<RESETMID_SAMPLES; i++)
+		stream[i] = 0;
+	len = 1000;
+	while(len < RESETMID_SAMPLES && (rv = mdc_encoder_get_samples(encoder, stream + len, RESETMID_SAMPLES - len)) > 0)
+		len += rv;
+	for(i = 0; i<RESETMID_SAMPLES; i++)
+	{
+		int v = stream[i] + noiseSample(3000);
+		stream[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+	}
+
+	mdc_decoder_process_samples(reset, stream, RESETMID_SAMPLES);
+	mdc_decoder_process_samples(fresh, stream, RESETMID_SAMPLES);
+	n1 = mdc_decoder_get_events(reset, ev1, RESETMID_EVENTS);
+	n2 = mdc_decoder_get_events(fresh, ev2, RESETMID_EVENTS);
+
+	if(n1 < 1 || n1 != n2 || ev1[0].op != 0x12 || ev1[0].arg != 0x34 || ev1[0].unitID != 0x5678)
+	{
+		fprintf(stderr,"runResetMid: %d and %d packets decoded\n", n1, n2);
+		exit(-1);
+	}
+	for(i = 0; i<n1; i++)
+	{
+		if(ev1[i].op != ev2[i].op || ev1[i].arg != ev2[i].arg || ev1[i].unitID != ev2[i].unitID ||
+		   ev1[i].syncSample != ev2[i].syncSample || ev1[i].endSample != ev2[i].endSample)
+		{
+			fprintf(stderr,"runResetMid: packet %d differs after reset\n", i);
+			exit(-1);
+		}
+	}
+
+	// a multi decoder's channel keeps its number through a reset
+	multi = mdc_multi_decoder_new(16000, 3);
+	chan = mdc_multi_decoder_get_channel(multi, 2);
+	if(!chan || mdc_decoder_process_samples(chan, stream, 300) < 0 || mdc_decoder_reset(chan))
+	{
+		fprintf(stderr,"runResetMid: channel reset failed\n");
+		exit(-1);
+	}
+	mdc_decoder_process_samples(chan, stream, RESETMID_SAMPLES);
+	n2 = mdc_decoder_get_events(chan, ev2, RESETMID_EVENTS);
+	if(n2 != n1 || ev2[0].channel != 2 || ev2[0].syncSample != ev1[0].syncSample)
+	{
+		fprintf(stderr,"runResetMid: reset channel reported %d packets on channel %d\n", n2, n2 > 0 ? ev2[0].channel : -1);
+		exit(-1);
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(reset);
+	mdc_decoder_destroy(fresh);
+	mdc_multi_decoder_destroy(multi);
+
+	printf("mid-packet reset success\n");
+}
+
+#define POOL_SIZE 1000
+
+void runPool(int flags)
+{
+	mdc_decoder_pool_t *pool;
+	mdc_decoder_t *d, *prev;
+	mdc_decoder_t *decoders[POOL_SIZE];
+	mdc_encoder_t *encoder;
+	mdc_sample_t buffer[NUMSAMPLES];
+	int i, n, rv, cont, found;
+
+	pool = mdc_decoder_pool_new(16000, POOL_SIZE, flags);
+	if(!pool)
+	{
+		fprintf(stderr,"mdc_decoder_pool_new() failed\n");
+		exit(-1);
+	}
+
+	for(i = 0; i<POOL_SIZE; i++)
+	{
+		decoders[i] = mdc_decoder_pool_acquire(pool);
+		if(!decoders[i] || ((size_t)decoders[i]) % MDC_CACHELINE || decoders[i]->channel != i ||
+		   mdc_decoder_pool_index(pool, decoders[i]) != i || (i && decoders[i] <= decoders[i-1]))
+		{
+			fprintf(stderr,"runPool: decoder %d misplaced\n", i);
+			exit(-1);
+		}
+	}
+
+	if(mdc_decoder_pool_acquire(pool) || mdc_decoder_pool_release(pool, (mdc_decoder_t *)((char *)decoders[5] + 8)) == 0)
+	{
+		fprintf(stderr,"runPool: exhausted pool or foreign decoder not refused\n");
+		exit(-1);
+	}
+
+	// hand back every third decoder, and check iteration skips them
+	for(i = 0; i<POOL_SIZE; i += 3)
+	{
+		if(mdc_decoder_pool_release(pool, decoders[i]))
+		{
+			fprintf(stderr,"mdc_decoder_pool_release() failed\n");
+			exit(-1);
+		}
+	}
+	if(mdc_decoder_pool_release(pool, decoders[0]) == 0)
+	{
+		fprintf(stderr,"runPool: double release not refused\n");
+		exit(-1);
+	}
+
+	n = 0;
+	prev = (mdc_decoder_t *)0L;
+	for(d = mdc_decoder_pool_next(pool, (mdc_decoder_t *)0L); d; d = mdc_decoder_pool_next(pool, d))
+	{
+		if((prev && d <= prev) || d->channel % 3 == 0)
+		{
+			fprintf(stderr,"runPool: iteration out of order\n");
+			exit(-1);
+		}
+		prev = d;
+		++n;
+	}
+	if(n != pool->count || n != POOL_SIZE - (POOL_SIZE + 2) / 3)
+	{
+		fprintf(stderr,"runPool: iterated %d decoders of %d\n", n, pool->count);
+		exit(-1);
+	}
+
+	// released slots come back, freshly initialized
+	d = mdc_decoder_pool_acquire(pool);
+	if(!d || d->channel % 3 != 0 || mdc_decoder_get_sample_count(d) != 0)
+	{
+		fprintf(stderr,"runPool: reacquire failed\n");
+		exit(-1);
+	}
+
+	// feed one signal to every acquired decoder
+	encoder = mdc_encoder_new(16000);
+	if(!encoder || mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678))
+	{
+		fprintf(stderr,"runPool: encoder failed\n");
+		exit(-1);
+	}
+
+	found = 0;
+	cont = 3;
+	while(cont)
+	{
+		rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+		if(rv <= 0)
+		{
+			--cont;
+			for(rv = 0; rv<NUMSAMPLES; rv++)
+				buffer[rv] = 0;
+		}
+		for(d = mdc_decoder_pool_next(pool, (mdc_decoder_t *)0L); d; d = mdc_decoder_pool_next(pool, d))
+		{
+			if(mdc_decoder_process_samples(d, buffer, rv) == 1)
+			{
+				mdc_decoder_event_t ev;
+
+				if(mdc_decoder_get_events(d, &ev, 1) != 1 || ev.arg != 0x34 || ev.channel != d->channel)
+				{
+					fprintf(stderr,"runPool: packet doesn't match\n");
+					exit(-1);
+				}
+				++found;
+			}
+		}
+	}
+
+	if(found != pool->count)
+	{
+		fprintf(stderr,"runPool: %d of %d decoders found the packet\n", found, pool->count);
+		exit(-1);
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_pool_destroy(pool);
+
+	printf("pool decode success%s\n", flags ? " (huge pages requested)" : "");
+}
+
+void runConfig(void)
+{
+	mdc_decoder_config_t config;
+	mdc_decoder_t *a, *b;
+	mdc_encoder_t *encoder;
+	mdc_u64_t mem[2][1024];
+	mdc_sample_t buffer[NUMSAMPLES];
+	int rv, cont, found;
+
+	// built-in configs are shared between decoders at a standard rate
+	a = mdc_decoder_new(16000);
+	b = mdc_decoder_new(16000);
+	if(!a || !b || a->config != b->config || a->config->sampleRate != 16000)
+	{
+		fprintf(stderr,"runConfig: built-in config not shared\n");
+		exit(-1);
+	}
+	mdc_decoder_destroy(a);
+	mdc_decoder_destroy(b);
+
+	// rates too low to decode at are refused rather than dividing by zero
+	if(mdc_decoder_new(1) || mdc_decoder_new(-1) || mdc_decoder_init(mem[0], 0) ||
+	   mdc_multi_decoder_new(1, 2) || mdc_decoder_config_init(&config, 1200) == 0)
+	{
+		fprintf(stderr,"runConfig: unusable rate accepted\n");
+		exit(-1);
+	}
+
+	// a caller's config for an unlisted rate, used by two decoders at once
+	if(mdc_decoder_config_init(&config, 11025) || mdc_decoder_config_init(&config, 0) == 0 ||
+	   mdc_decoder_config_init(&config, 11025))
+	{
+		fprintf(stderr,"mdc_decoder_config_init() failed\n");
+		exit(-1);
+	}
+
+	a = mdc_decoder_init_config(mem[0], &config);
+	b = mdc_decoder_init_config(mem[1], &config);
+	encoder = mdc_encoder_new(11025);
+	if(!a || !b || !encoder || a->config != &config || b->config != &config ||
+	   mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678))
+	{
+		fprintf(stderr,"runConfig: create failed\n");
+		exit(-1);
+	}
+
+	found = 0;
+	cont = 3;
+	while(cont)
+	{
+		rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+		if(rv <= 0)
+		{
+			--cont;
+			for(rv = 0; rv<NUMSAMPLES; rv++)
+				buffer[rv] = 0;
+		}
+		found += mdc_decoder_process_samples(a, buffer, rv) == 1 && mdc_decoder_get_packet(a, 0L, 0L, 0L) == 0;
+		found += mdc_decoder_process_samples(b, buffer, rv) == 1 && mdc_decoder_get_packet(b, 0L, 0L, 0L) == 0;
+	}
+
+	if(found != 2)
+	{
+		fprintf(stderr,"runConfig: found %d packets, expected 2\n", found);
+		exit(-1);
+	}
+
+	mdc_encoder_destroy(encoder);
+
+	printf("shared config decode success\n");
+}
+
+#define ENGINE_CHANNELS 64
+#define ENGINE_PACKETS 3
+#define ENGINE_BLOCK 100
+#define ENGINE_GAP 4096	// silence between packets; shorter gaps lose the odd packet even on one decoder
+#define ENGINE_LENGTH (ENGINE_PACKETS * 8192)
+void runEngine(int numWorkers, int flags)
+{
+	mdc_engine_t *engine;
+	mdc_encoder_t *encoder;
+	mdc_decoder_event_t events[64];
+	mdc_sample_t *samples;
+	int length[ENGINE_CHANNELS], next[ENGINE_CHANNELS];
+	unsigned long jobs, steals, total;
+	int c, k, i, rv, n, found, busy;
+
+	engine = mdc_engine_new(16000, ENGINE_CHANNELS, numWorkers, flags);
+	encoder = mdc_encoder_new(16000);
+	samples = (mdc_sample_t *)calloc(ENGINE_CHANNELS * ENGINE_LENGTH, sizeof(mdc_sample_t));
+	if(!engine || !encoder || !samples)
+	{
+		fprintf(stderr,"runEngine: create failed\n");
+		exit(-1);
+	}
+
+	// each channel's decoder is in its home worker's pool
+	for(c=0; c<ENGINE_CHANNELS; c++)
+	{
+		if(mdc_decoder_pool_index(engine->workers[c % numWorkers].pool, engine->channels[c].decoder) < 0 ||
+		   engine->channels[c].decoder->channel != c)
+		{
+			fprintf(stderr,"runEngine: channel %d decoder misplaced\n", c);
+			exit(-1);
+		}
+	}
+
+	// each channel carries its own packets, the channel number in the unit ID
+	for(c=0; c<ENGINE_CHANNELS; c++)
+	{
+		mdc_sample_t *p = samples + c * ENGINE_LENGTH;
+
+		length[c] = 0;
+		for(k=0; k<ENGINE_PACKETS; k++)
+		{
+			if(mdc_encoder_set_packet(encoder, 0x12, k, 0x1000 + c))
+			{
+				fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+				exit(-1);
+			}
+			while((rv = mdc_encoder_get_samples(encoder, p + length[c], ENGINE_LENGTH / ENGINE_PACKETS - ENGINE_GAP)) > 0)
+				length[c] += rv;
+			length[c] += ENGINE_GAP;
+		}
+		next[c] = 0;
+	}
+
+	// interleaved blocks, as they would arrive from many live streams
+	do
+	{
+		busy = 0;
+		for(c=0; c<ENGINE_CHANNELS; c++)
+		{
+			n = length[c] - next[c];
+			if(n > ENGINE_BLOCK)
+				n = ENGINE_BLOCK;
+			if(n <= 0)
+				continue;
+			if(mdc_engine_submit(engine, c, samples + c * ENGINE_LENGTH + next[c], n))
+			{
+				fprintf(stderr,"mdc_engine_submit() failed\n");
+				exit(-1);
+			}
+			next[c] += n;
+			busy = 1;
+		}
+	} while(busy);
+
+	if(mdc_engine_submit(engine, ENGINE_CHANNELS, samples, 1) == 0 || mdc_engine_flush(engine))
+	{
+		fprintf(stderr,"runEngine: submit or flush check failed\n");
+		exit(-1);
+	}
+
+	// every packet once, with its channel, and in order within the channel
+	for(c=0; c<ENGINE_CHANNELS; c++)
+		next[c] = 0;
+	found = 0;
+	while((n = mdc_engine_get_events(engine, events, 64)) > 0)
+	{
+		for(i=0; i<n; i++)
+		{
+			c = events[i].channel;
+			if(c < 0 || c >= ENGINE_CHANNELS || events[i].unitID != 0x1000 + c ||
+			   events[i].op != 0x12 || events[i].arg != next[c])
+			{
+				fprintf(stderr,"runEngine: unexpected packet %02x %02x %04x on channel %d\n",
+				        events[i].op, events[i].arg, events[i].unitID, c);
+				exit(-1);
+			}
+			next[c]++;
+			found++;
+		}
+	}
+
+	if(found != ENGINE_CHANNELS * ENGINE_PACKETS || mdc_engine_get_dropped(engine))
+	{
+		fprintf(stderr,"runEngine: found %d packets, expected %d\n", found, ENGINE_CHANNELS * ENGINE_PACKETS);
+		exit(-1);
+	}
+
+	total = 0;
+	for(i=0; i<numWorkers; i++)
+	{
+		mdc_engine_get_stats(engine, i, &jobs, &steals);
+		total += jobs;
+		if((flags & MDC_ENGINE_STICKY) && steals)
+		{
+			fprintf(stderr,"runEngine: sticky worker %d stole %lu channels\n", i, steals);
+			exit(-1);
+		}
+	}
+	for(c=0, n=0; c<ENGINE_CHANNELS; c++)
+		n += (length[c] + ENGINE_BLOCK - 1) / ENGINE_BLOCK;
+	if(total != (unsigned long)n)
+	{
+		fprintf(stderr,"runEngine: %lu blocks decoded, expected %d\n", total, n);
+		exit(-1);
+	}
+
+	mdc_engine_destroy(engine);
+	mdc_encoder_destroy(encoder);
+	free(samples);
+
+	printf("engine decode success (%d workers%s%s)\n", numWorkers,
+	       (flags & MDC_ENGINE_PIN) ? ", pinned" : "", (flags & MDC_ENGINE_STICKY) ? ", sticky" : "");
+}
+
+#define BUS_PRODUCERS 4
+#define BUS_EVENTS 100000
+mdc_event_bus_t *busUnderTest;
+int busProducersDone;
+
+void *busProducer(void *arg)
+{
+	mdc_decoder_event_t event;
+	int i;
+
+	event.channel = (int)(long)arg;
+	for(i=0; i<BUS_EVENTS; i++)
+	{
+		event.syncSample = i;
+		mdc_event_bus_publish(busUnderTest, &event);
+	}
+	__atomic_add_fetch(&busProducersDone, 1, __ATOMIC_SEQ_CST);
+	return 0L;
+}
+
+// drains until every producer is done and the bus is empty, checking per-producer order
+void *busConsumer(void *arg)
+{
+	mdc_decoder_event_t events[64];
+	long long last[BUS_PRODUCERS];
+	long *received = (long *)arg;
+	int i, n, done;
+
+	for(i=0; i<BUS_PRODUCERS; i++)
+		last[i] = -1;
+
+	do
+	{
+		done = __atomic_load_n(&busProducersDone, __ATOMIC_SEQ_CST) == BUS_PRODUCERS;
+		while((n = mdc_event_bus_drain(busUnderTest, events, 64)) > 0)
+		{
+			for(i=0; i<n; i++)
+			{
+				if((long long)events[i].syncSample <= last[events[i].channel])
+				{
+					fprintf(stderr,"runBus: producer %d out of order\n", events[i].channel);
+					exit(-1);
+				}
+				last[events[i].channel] = events[i].syncSample;
+			}
+			*received += n;
+		}
+	} while(!done);
+
+	return 0L;
+}
+
+void runBus(void)
+{
+	mdc_event_bus_t *bus;
+	mdc_decoder_event_t event, events[16];
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_sample_t buffer[NUMSAMPLES];
+	pthread_t producers[BUS_PRODUCERS], consumer;
+	unsigned long published, dropped;
+	long received[2];
+	int i, n, rv, cont;
+
+	if(mdc_event_bus_new(0) || !(bus = mdc_event_bus_new(5)))
+	{
+		fprintf(stderr,"mdc_event_bus_new() failed\n");
+		exit(-1);
+	}
+
+	// capacity rounds up to 8: the last two are dropped, the rest come off in order
+	for(i=0; i<10; i++)
+	{
+		event.arg = i;
+		rv = mdc_event_bus_publish(bus, &event);
+		if((i < 8) != (rv == 0))
+		{
+			fprintf(stderr,"mdc_event_bus_publish() %d returned %d\n", i, rv);
+			exit(-1);
+		}
+	}
+	n = mdc_event_bus_drain(bus, events, 3);
+	n += mdc_event_bus_drain(bus, events + n, 16 - n);
+	mdc_event_bus_get_stats(bus, &published, &dropped);
+	if(n != 8 || published != 8 || dropped != 2 || mdc_event_bus_drain(bus, events, 16) != 0)
+	{
+		fprintf(stderr,"runBus: drained %d, published %lu, dropped %lu\n", n, published, dropped);
+		exit(-1);
+	}
+	for(i=0; i<n; i++)
+	{
+		if(events[i].arg != i)
+		{
+			fprintf(stderr,"runBus: packet %d out of order\n", i);
+			exit(-1);
+		}
+	}
+	mdc_event_bus_destroy(bus);
+
+	// a decoder publishing instead of calling back
+	bus = mdc_event_bus_new(16);
+	decoder = mdc_decoder_new(16000);
+	encoder = mdc_encoder_new(16000);
+	if(!bus || !decoder || !encoder || mdc_encoder_set_packet(encoder, 0x12, 0x34, 0x5678))
+	{
+		fprintf(stderr,"runBus: create failed\n");
+		exit(-1);
+	}
+	mdc_decoder_set_event_callback(decoder, mdc_event_bus_event_callback, bus);
+	cont = 3;
+	while(cont)
+	{
+		rv = mdc_encoder_get_samples(encoder, buffer, NUMSAMPLES);
+		if(rv <= 0)
+		{
+			--cont;
+			for(rv = 0; rv<NUMSAMPLES; rv++)
+				buffer[rv] = 0;
+		}
+		mdc_decoder_process_samples(decoder, buffer, rv);
+	}
+	n = mdc_event_bus_drain(bus, events, 16);
+	if(n != 1 || events[0].op != 0x12 || events[0].arg != 0x34 || events[0].unitID != 0x5678)
+	{
+		fprintf(stderr,"runBus: decoder published %d packets\n", n);
+		exit(-1);
+	}
+	mdc_decoder_destroy(decoder);
+	mdc_encoder_destroy(encoder);
+	mdc_event_bus_destroy(bus);
+
+	// many publishers, two consumers, a bus small enough to fill up
+	busUnderTest = mdc_event_bus_new(256);
+	busProducersDone = 0;
+	received[0] = received[1] = 0;
+	if(!busUnderTest || pthread_create(&consumer, 0L, busConsumer, &received[1]))
+	{
+		fprintf(stderr,"runBus: create failed\n");
+		exit(-1);
+	}
+	for(i=0; i<BUS_PRODUCERS; i++)
+	{
+		if(pthread_create(&producers[i], 0L, busProducer, (void *)(long)i))
+		{
+			fprintf(stderr,"runBus: create failed\n");
+			exit(-1);
+		}
+	}
+	busConsumer(&received[0]);
+	for(i=0; i<BUS_PRODUCERS; i++)
+		pthread_join(producers[i], 0L);
+	pthread_join(consumer, 0L);
+
+	mdc_event_bus_get_stats(busUnderTest, &published, &dropped);
+	if(published + dropped != BUS_PRODUCERS * BUS_EVENTS || received[0] + received[1] != (long)published)
+	{
+		fprintf(stderr,"runBus: published %lu, dropped %lu, received %ld\n", published, dropped, received[0] + received[1]);
+		exit(-1);
+	}
+	mdc_event_bus_destroy(busUnderTest);
+
+	printf("event bus success\n");
+}
+
+#define PLL_PACKETS 20
+#define PLL_SILENCE 4096
+
+/*
+ * decode PLL_PACKETS packets, each after a little more silence than the
+ * last, from an encoder running at encoderRate while the decoder assumes
+ * sampleRate; the end of each packet found goes into ends
+ */
+int pllDecode(int sampleRate, int encoderRate, int units, int block, int noise, mdc_u64_t *ends)
+{
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_decoder_event_t event;
+	mdc_sample_t buffer[NUMSAMPLES];
+	int p, i, rv, found = 0;
+
+	encoder = mdc_encoder_new(encoderRate);
+	decoder = mdc_decoder_new(sampleRate);
+	if(!encoder || !decoder || mdc_decoder_set_pll(decoder, units))
+	{
+		fprintf(stderr,"runPll: create failed\n");
+		exit(-1);
+	}
+
+	noiseSeed = 1;
+
+	for(p = 0; p<PLL_PACKETS; p++)
+	{
+		int silence = PLL_SILENCE + p * 37;
+
+		if(mdc_encoder_set_packet(encoder, 0x01, p, 0x3000 + p))
+		{
+			fprintf(stderr,"mdc_encoder_set_packet() failed\n");
+			exit(-1);
+		}
+
+		while(silence > 0)
+		{
+			rv = mdc_encoder_get_samples(encoder, buffer, block);
+			if(rv <= 0)
+			{
+				rv = silence < block ? silence : block;
+				silence -= rv;
+				for(i = 0; i<rv; i++)
+					buffer[i] = 0;
+			}
+
+			for(i = 0; i<rv; i++)
+			{
+				int v = buffer[i] + noiseSample(noise);
+				buffer[i] = v > 32767 ? 32767 : (v < -32768 ? -32768 : v);
+			}
+
+			mdc_decoder_process_samples(decoder, buffer, rv);
+			while(mdc_decoder_get_events(decoder, &event, 1) == 1)
+			{
+				if(event.op == 0x01 && event.arg == p && event.unitID == 0x3000 + p)
+					ends[found++] = event.endSample;
+			}
+		}
+	}
+
+	mdc_encoder_destroy(encoder);
+	mdc_decoder_destroy(decoder);
+	return found;
+}
+
+void runPll(int sampleRate)
+{
+	mdc_decoder_t *decoder;
+	mdc_u64_t ends[2][PLL_PACKETS];
+	int units, found, fixed, drift;
+
+	decoder = mdc_decoder_new(sampleRate);
+	if(!decoder)
+	{
+		fprintf(stderr,"runPll: create failed\n");
+		exit(-1);
+	}
+	if(mdc_decoder_set_pll(decoder, -1) != -1 || mdc_decoder_set_pll(decoder, MDC_PLLUNITS + 1) != -1 ||
+	   mdc_decoder_set_pll(decoder, MDC_PLLUNITS) || mdc_decoder_set_pll(decoder, 0))
+	{
+		fprintf(stderr,"mdc_decoder_set_pll() failed\n");
+		exit(-1);
+	}
+	mdc_decoder_destroy(decoder);
+
+	// the fixed units against a sender whose clock runs 0.2% fast
+	fixed = pllDecode(sampleRate, sampleRate + sampleRate / 500, 0, NUMSAMPLES, 2000, ends[0]);
+
+	for(units = 1; units<=MDC_PLLUNITS; units++)
+	{
+		// one unit may settle a third of a bit off, more cover that
+		found = pllDecode(sampleRate, sampleRate, units, NUMSAMPLES, 2000, ends[0]);
+		if(found < (units > 1 ? PLL_PACKETS : PLL_PACKETS * 3 / 4))
+		{
+			fprintf(stderr,"runPll %d: %d units found %d/%d\n", sampleRate, units, found, PLL_PACKETS);
+			exit(-1);
+		}
+
+		// the same stream in small blocks decodes identically
+		if(pllDecode(sampleRate, sampleRate, units, 77, 2000, ends[1]) != found ||
+		   memcmp(ends[0], ends[1], found * sizeof(ends[0][0])))
+		{
+			fprintf(stderr,"runPll %d: %d units depend on block size\n", sampleRate, units);
+			exit(-1);
+		}
+
+		drift = pllDecode(sampleRate, sampleRate + sampleRate / 500, units, NUMSAMPLES, 2000, ends[1]);
+		if(units > 1 && drift < fixed)
+		{
+			fprintf(stderr,"runPll %d: %d units found %d/%d with clock offset, fixed units %d\n", sampleRate, units, drift, PLL_PACKETS, fixed);
+			exit(-1);
+		}
+	}
+
+	printf("pll %d decode success\n", sampleRate);
+}
+
+#define ENCODE_MAX 40000
+
+/*
+ * render one double packet with the given block size, returning its length
+ */
+int encodeBlocks(int sampleRate, int block, short *out)
+{
+	mdc_encoder_t *encoder;
+	int rv, len = 0;
+
+	encoder = mdc_encoder_new(sampleRate);
+	if(!encoder || mdc_encoder_set_preamble(encoder, 2) ||
+	   mdc_encoder_set_double_packet(encoder, 0x35, 0x8a, 0x1234, 0x0a, 0x0b, 0x0c, 0x0d))
+	{
+		fprintf(stderr,"runEncodeBlocks: create failed\n");
+		exit(-1);
+	}
+
+	while(len < ENCODE_MAX && (rv = mdc_encoder_get_samples_s16(encoder, out + len, block < ENCODE_MAX - len ? block : ENCODE_MAX - len)) > 0)
+		len += rv;
+
+	mdc_encoder_destroy(encoder);
+	return len;
+}
+
+void runEncodeBlocks(void)
+{
+	static const int rates[] = { 8000, 16000, 22050, 44100, 48000, 12345 };
+	static const int blocks[] = { 1, 7, 13, 4096 };
+	static short ref[ENCODE_MAX], out[ENCODE_MAX];
+	mdc_u64_t mem[256];
+	int r, b, len;
+
+	// rates too low to encode at are refused rather than dividing by zero
+	if(mdc_encoder_new(1) || mdc_encoder_new(-1) || mdc_encoder_new(1800) ||
+	   (int)sizeof(mem) < mdc_encoder_sizeof() || mdc_encoder_init(mem, 0))
+	{
+		fprintf(stderr,"runEncodeBlocks: unusable rate accepted\n");
+		exit(-1);
+	}
+
+	for(r = 0; r<(int)(sizeof(rates)/sizeof(rates[0])); r++)
+	{
+		len = encodeBlocks(rates[r], ENCODE_MAX, ref);
+		if(len <= 0 || len >= ENCODE_MAX || ref[len - 1] != 0)
+		{
+			fprintf(stderr,"runEncodeBlocks %d: packet of %d samples\n", rates[r], len);
+			exit(-1);
+		}
+
+		// bit boundaries fall at different places within each block
+		for(b = 0; b<(int)(sizeof(blocks)/sizeof(blocks[0])); b++)
+		{
+			if(encodeBlocks(rates[r], blocks[b], out) != len || memcmp(ref, out, len * sizeof(ref[0])))
+			{
+				fprintf(stderr,"runEncodeBlocks %d: output differs with %d-sample blocks\n", rates[r], blocks[b]);
+				exit(-1);
+			}
+		}
+	}
+
+	printf("encoder block size success\n");
+}
+
+void runCache(void)
+{
+	static short ref[ENCODE_MAX];
+	static float fref[ENCODE_MAX];
+	mdc_packet_cache_t *cache;
+	mdc_encoder_t *encoder;
+	const void *a, *b, *p;
+	int len, na, nb, n, rv;
+
+	cache = mdc_packet_cache_new(2);
+	if(!cache)
+	{
+		fprintf(stderr,"runCache: create failed\n");
+		exit(-1);
+	}
+
+	// the same audio an encoder gives, the second time without encoding
+	len = encodeBlocks(8000, ENCODE_MAX, ref);
+	a = mdc_packet_cache_get_double(cache, 8000, MDC_SAMPLE_S16, 2, 0x35, 0x8a, 0x1234, 0x0a, 0x0b, 0x0c, 0x0d, &na);
+	if(!a || na != len || memcmp(a, ref, len * sizeof(ref[0])))
+	{
+		fprintf(stderr,"runCache: double packet differs from encoder\n");
+		exit(-1);
+	}
+	p = mdc_packet_cache_get_double(cache, 8000, MDC_SAMPLE_S16, 2, 0x35, 0x8a, 0x1234, 0x0a, 0x0b, 0x0c, 0x0d, &n);
+	if(p != a || n != na || cache->hits != 1 || cache->misses != 1)
+	{
+		fprintf(stderr,"runCache: repeat packet not a hit\n");
+		exit(-1);
+	}
+
+	encoder = mdc_encoder_new(48000);
+	if(!encoder || mdc_encoder_set_packet(encoder, 0x01, 0x80, 0x5678))
+	{
+		fprintf(stderr,"runCache: encoder create failed\n");
+		exit(-1);
+	}
+	len = 0;
+	while(len < ENCODE_MAX && (rv = mdc_encoder_get_samples_float(encoder, fref + len, ENCODE_MAX - len)) > 0)
+		len += rv;
+	mdc_encoder_destroy(encoder);
+
+	b = mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_FLOAT, 0, 0x01, 0x80, 0x5678, &nb);
+	if(!b || nb != len || memcmp(b, fref, len * sizeof(fref[0])))
+	{
+		fprintf(stderr,"runCache: packet differs from encoder\n");
+		exit(-1);
+	}
+
+	// the key takes in the format and preamble, and the oldest entry goes first
+	if(mdc_packet_cache_get_double(cache, 8000, MDC_SAMPLE_S16, 2, 0x35, 0x8a, 0x1234, 0x0a, 0x0b, 0x0c, 0x0d, &n) != a ||
+	   !mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_S16, 0, 0x01, 0x80, 0x5678, &n) ||
+	   mdc_packet_cache_get_double(cache, 8000, MDC_SAMPLE_S16, 2, 0x35, 0x8a, 0x1234, 0x0a, 0x0b, 0x0c, 0x0d, &n) != a ||
+	   !mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_FLOAT, 0, 0x01, 0x80, 0x5678, &n) ||
+	   !mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_FLOAT, 1, 0x01, 0x80, 0x5678, &n) ||
+	   cache->hits != 3 || cache->misses != 5)
+	{
+		fprintf(stderr,"runCache: wrong entry pushed out (%lu hits %lu misses)\n", cache->hits, cache->misses);
+		exit(-1);
+	}
+
+	if(mdc_packet_cache_get(cache, 48000, MDC_SAMPLE_FLOAT, -1, 0x01, 0x80, 0x5678, &n))
+	{
+		fprintf(stderr,"runCache: bad preamble accepted\n");
+		exit(-1);
+	}
+
+	mdc_packet_cache_destroy(cache);
+
+	printf("packet cache success\n");
+}
+
+#define ENCQUEUE_PACKETS 5
+#define ENCQUEUE_MAX 65536
+
+/*
+ * queue ENCQUEUE_PACKETS packets on one encoder, alternating single and
+ * double, each with its own preamble, and render them with the given
+ * block size, returning the length
+ */
+int encodeQueue(int sampleRate, int gap, int block, short *out)
+{
+	mdc_encoder_t *encoder;
+	int p, rv, len = 0;
+
+	encoder = mdc_encoder_new(sampleRate);
+	if(!encoder || mdc_encoder_set_gap(encoder, gap))
+	{
+		fprintf(stderr,"runEncodeQueue: create failed\n");
+		exit(-1);
+	}
+
+	for(p = 0; p<ENCQUEUE_PACKETS; p++)
+	{
+		mdc_encoder_set_preamble(encoder, p);
+		if((p & 1 ? mdc_encoder_queue_double_packet(encoder, 0x35, p, 0x4000 + p, 1, 2, 3, p) :
+		            mdc_encoder_queue_packet(encoder, 0x01, p, 0x4000 + p)) ||
+		   mdc_encoder_queued(encoder) != p)
+		{
+			fprintf(stderr,"runEncodeQueue: queue packet %d failed\n", p);
+			exit(-1);
+		}
+	}
+
+	while(len < ENCQUEUE_MAX && (rv = mdc_encoder_get_samples_s16(encoder, out + len, block < ENCQUEUE_MAX - len ? block : ENCQUEUE_MAX - len)) > 0)
+		len += rv;
+
+	mdc_encoder_destroy(encoder);
+	return len;
+}
+
+void runEncodeQueue(void)
+{
+	static const int blocks[] = { 1, 13, ENCQUEUE_MAX };
+	static short ref[ENCQUEUE_MAX], out[ENCQUEUE_MAX];
+	mdc_encoder_t *encoder;
+	mdc_decoder_t *decoder;
+	mdc_decoder_event_t event;
+	int p, b, rv, len, found;
+
+	// with a gap, each packet is as it would be alone
+	encoder = mdc_encoder_new(16000);
+	len = 0;
+	for(p = 0; p<ENCQUEUE_PACKETS; p++)
+	{
+		if(p)
+		{
+			memset(ref + len, 0, 100 * sizeof(ref[0]));
+			len += 100;
+		}
+		mdc_encoder_set_preamble(encoder, p);
+		if(p & 1)
+			mdc_encoder_set_double_packet(encoder, 0x35, p, 0x4000 + p, 1, 2, 3, p);
+		else
+			mdc_encoder_set_packet(encoder, 0x01, p, 0x4000 + p);
+		while((rv = mdc_encoder_get_samples_s16(encoder, ref + len, ENCQUEUE_MAX - len)) > 0)
+			len += rv;
+	}
+	mdc_encoder_destroy(encoder);
+
+	for(b = 0; b<(int)(sizeof(blocks)/sizeof(blocks[0])); b++)
+	{
+		if(encodeQueue(16000, 100, blocks[b], out) != len || memcmp(ref, out, len * sizeof(ref[0])))
+		{
+			fprintf(stderr,"runEncodeQueue: gapped packets differ with %d-sample blocks\n", blocks[b]);
+			exit(-1);
+		}
+	}
+
+	// without one, they run together and all still decode
+	len = encodeQueue(48000, 0, ENCQUEUE_MAX, ref);
+	for(b = 0; b<(int)(sizeof(blocks)/sizeof(blocks[0])); b++)
+	{
+		if(encodeQueue(48000, 0, blocks[b], out) != len || memcmp(ref, out, len * sizeof(ref[0])))
+		{
+			fprintf(stderr,"runEncodeQueue: packets differ with %d-sample blocks\n", blocks[b]);
+			exit(-1);
+		}
+	}
+
+	decoder = mdc_decoder_new(48000);
+	if(!decoder)
+	{
+		fprintf(stderr,"runEncodeQueue: decoder create failed\n");
+		exit(-1);
+	}
+	mdc_decoder_process_samples_s16(decoder, ref, len);
+	memset(out, 0, 1000 * sizeof(out[0]));
+	mdc_decoder_process_samples_s16(decoder, out, 1000);
+
+	found = 0;
+	while(mdc_decoder_get_events(decoder, &event, 1) == 1)
+	{
+		if(event.arg != found || event.unitID != 0x4000 + found ||
+		   event.op != (found & 1 ? 0x35 : 0x01) || (found & 1 && event.extra3 != found))
+			break;
+		found++;
+	}
+	mdc_decoder_destroy(decoder);
+
+	if(found != ENCQUEUE_PACKETS)
+	{
+		fprintf(stderr,"runEncodeQueue: %d of %d back to back packets decoded\n", found, ENCQUEUE_PACKETS);
+		exit(-1);
+	}
+
+	// a full queue turns packets away
+	encoder = mdc_encoder_new(8000);
+	for(p = 0; p<=MDC_PACKETQ; p++)
+		mdc_encoder_queue_packet(encoder, 0x01, p, 0x4000);
+	if(mdc_encoder_queued(encoder) != MDC_PACKETQ || mdc_encoder_queue_packet(encoder, 0x01, p, 0x4000) != -1 ||
+	   mdc_encoder_reset(encoder) || mdc_encoder_queued(encoder) != 0)
+	{
+		fprintf(stderr,"runEncodeQueue: queue limit not kept\n");
+		exit(-1);
+	}
+	mdc_encoder_destroy(encoder);
+
+	printf("encoder queue success\n");
+}
+
+// the original _enc_str: CRC, parity and interleave for the 4 bytes at data
+unsigned char * refEncStr(unsigned char *data)
+{
+	unsigned short crc;
+	unsigned char frame[14];
+	int i, j, k, m;
+	int lbits[112];
+
+	crc = _docrc(data, 4);
+	memcpy(frame, data, 4);
+	frame[4] = crc & 0x00ff;
+	frame[5] = (crc >> 8) & 0x00ff;
+	frame[6] = 0;
+	refParity(frame);
+
+	k = 0;
+	m = 0;
+	for(i=0; i<14; i++)
+	{
+		for(j=0; j<=7; j++)
+		{
+			lbits[k] = 0x01 & (frame[i] >> j);
+			k += 16;
+			if(k > 111)
+				k = ++m;
+		}
+	}
+
+	k = 0;
+	for(i=0; i<14; i++)
+	{
+		data[i] = 0;
+		for(j=7; j>=0; j--)
+		{
+			if(lbits[k])
+				data[i] |= 1<<j;
+			++k;
+		}
+	}
+
+	return &(data[14]);
+}
+
+#define LAYOUT_PACKETS 4000
+
+/* single and double packets of random content, frames compared byte for byte */
+void runPacketLayout(void)
+{
+	mdc_encoder_t *encoder;
+	unsigned char bytes[8], ref[28];
+	int n, i, len;
+
+	encoder = mdc_encoder_new(16000);
+	if(!encoder)
+	{
+		fprintf(stderr,"runPacketLayout: create failed\n");
+		exit(-1);
+	}
+
+	frameSeed = 9;
+	for(n = 0; n<LAYOUT_PACKETS; n++)
+	{
+		for(i=0; i<8; i++)
+			bytes[i] = frameByte();
+
+		memcpy(ref, bytes, 4);
+		if(n & 1)
+		{
+			memcpy(refEncStr(ref), bytes + 4, 4);
+			refEncStr(ref + 14);
+			len = 28;
+			mdc_encoder_set_double_packet(encoder, bytes[0], bytes[1], (bytes[2] << 8) | bytes[3],
+			                              bytes[4], bytes[5], bytes[6], bytes[7]);
+		}
+		else
+		{
+			refEncStr(ref);
+			len = 14;
+			mdc_encoder_set_packet(encoder, bytes[0], bytes[1], (bytes[2] << 8) | bytes[3]);
+		}
+
+		// frames follow the 12-byte preamble and sync word
+		if(memcmp(encoder->data + 12, ref, len))
+		{
+			fprintf(stderr,"runPacketLayout: packet %d differs\n", n);
+			exit(-1);
+		}
+		mdc_encoder_reset(encoder);
+	}
+
+	mdc_encoder_destroy(encoder);
+
+	printf("packet layout success\n");
+}
@@ -41,6 +41,7 @@ typedef unsigned short mdc_u16_t;
 typedef char mdc_s8_t;
 typedef unsigned char mdc_u8_t;
 typedef int mdc_int_t;
+typedef unsigned long long mdc_u64_t;
 
 #ifndef MDC_FIXEDMATH
 typedef double mdc_float_t;
@@ -55,5 +56,26 @@ typedef short mdc_sample_t;
 /* #define MDC_SAMPLE_FORMAT_U16 */
 /* #define MDC_SAMPLE_FORMAT_FLOAT */
 
+/* sample formats that can be chosen at runtime, through the
+   format-specific _u8/_s16/_u16/_float entry points */
+typedef enum {
+	MDC_SAMPLE_U8,
+	MDC_SAMPLE_S16,
+	MDC_SAMPLE_U16,
+	MDC_SAMPLE_FLOAT
+} mdc_sample_format_t;
+
+/* the runtime format matching mdc_sample_t */
+#if defined(MDC_SAMPLE_FORMAT_U8)
+#define MDC_SAMPLE_FORMAT MDC_SAMPLE_U8
+#elif defined(MDC_SAMPLE_FORMAT_U16)
+#define MDC_SAMPLE_FORMAT MDC_SAMPLE_U16
+#elif defined(MDC_SAMPLE_FORMAT_S16)
+#define MDC_SAMPLE_FORMAT MDC_SAMPLE_S16
+#elif defined(MDC_SAMPLE_FORMAT_FLOAT)
+#define MDC_SAMPLE_FORMAT MDC_SAMPLE_FLOAT
+#else
+#error "no known sample format set"
+#endif
 
 #endif